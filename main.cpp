@@ -3,22 +3,58 @@
 #include <fstream>
 #include <vector>
 #include <stack>
+#include <map>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <algorithm>
+#include <iterator>
 #include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
 #include <cassert>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <elf.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 // For systems that support C++20 this is a nice library
 // #include <format>
 
 
+// Besides the source symbols the optimizer produces two more opcodes:
+// 	'z' clears the cell
+// 	'*' adds the cell at `source` times the operand to the cell
+// every opcode but the loops and the moves applies to the cell at `offset` from the head
 struct Instruction {
 	int  position;
 	char opcode;
 	int  operand;
+	int  offset = 0;
+	int  source = 0;
 };
 
 
 std::ostream& operator<<(std::ostream &os, Instruction I) {
-	os << "(" << I.position << " , " << I.opcode << ", " << I.operand << ")" << std::endl;
+	os << "(" << I.position << " , " << I.opcode << ", " << I.operand << ", " << I.offset << ", " << I.source << ")" << std::endl;
 
 	return os;
 }
@@ -47,251 +83,4905 @@ std::vector<Instruction> load_program_source(std::istream &in) {
 }
 
 
-void build_jump_table(std::vector<Instruction> &program) {
-	std::stack<size_t> call_stack;
+// The fast path of load_program_source used for files: the source is memory mapped and classified
+// 64 bytes at a time into a bitmask of the symbols, so that comments are skipped without looking at them.
+// Runs of +-<> are measured with a popcount over the bitmask of the repeated symbol
+struct LexerKernel {
+	uint64_t (*symbols)(const char *block);		// bit i is set when block[i] is one of +-<>,.[]
+	uint64_t (*equal)(const char *block, char c);	// bit i is set when block[i] == c
+};
 
-	for (size_t i = 0; i < program.size(); ++i) {
-		if (program[i].opcode == '[') {
-			call_stack.push(i);
-		}
-		else if (program[i].opcode == ']') {
-			if (call_stack.empty()) {
-				std::cerr << "Unexpected closed parenthesis at " << program[i].position << std::endl;
-				break;
-			}
 
-			program[i].operand = call_stack.top();
-			program[call_stack.top()].operand = i;
-			call_stack.pop();
-		}
+uint64_t symbols_scalar(const char *block) {
+	uint64_t mask = 0;
+
+	for (int i = 0; i < 64; ++i) {
+		mask |= uint64_t(block[i] != '\0' and strchr("+-<>,.[]", block[i]) != NULL) << i;
 	}
+
+	return mask;
 }
 
 
-void run(std::istream &in, std::ostream &out, const std::vector<Instruction> &program, size_t memory_size = 1000) {
-	std::vector<char> memory(memory_size);
+uint64_t equal_scalar(const char *block, char c) {
+	uint64_t mask = 0;
 
-	size_t pc   = 0;
-	size_t head = 0;
+	for (int i = 0; i < 64; ++i) {
+		mask |= uint64_t(block[i] == c) << i;
+	}
 
-	while (pc < program.size()) {
-		const Instruction I = program[pc];
+	return mask;
+}
 
-		switch (I.opcode) {
-			case '+': memory[head] += I.operand;			break;
-			case '-': memory[head] -= I.operand;			break;
-			case '<': head -= I.operand;				break;
-			case '>': head += I.operand;				break;
-			case ',': memory[head] = in.eof() ? 0 : in.get();	break;
-			case '.': out << memory[head];				break;
-			case '[': pc = memory[head] == 0 ? I.operand : pc;	break;
-			case ']': pc = memory[head] == 0 ? pc : I.operand;	break;
-		}
 
-		++pc;
+#if defined(__x86_64__)
+
+// The symbols are recognized with two table lookups (pshufb), one per nibble:
+// the high nibble of each symbol is 2, 3 or 5, encoded as bits 0, 1 and 2 of the result of `high`,
+// while `low` tells which of those high nibbles form a symbol together with the low nibble
+//
+// 	'+' 2B  ',' 2C  '-' 2D  '.' 2E  '<' 3C  '>' 3E  '[' 5B  ']' 5D
+#define LEXER_LOW_TABLE  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 5, 3, 5, 3, 0
+#define LEXER_HIGH_TABLE 0, 0, 1, 2, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+
+
+__attribute__((target("avx2")))
+uint64_t symbols_avx2(const char *block) {
+	const __m256i low_table  = _mm256_setr_epi8(LEXER_LOW_TABLE,  LEXER_LOW_TABLE);
+	const __m256i high_table = _mm256_setr_epi8(LEXER_HIGH_TABLE, LEXER_HIGH_TABLE);
+	const __m256i nibble     = _mm256_set1_epi8(0x0f);
+	uint64_t mask = 0;
+
+	for (int half = 0; half < 2; ++half) {
+		const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + 32 * half));
+		const __m256i low   = _mm256_shuffle_epi8(low_table,  _mm256_and_si256(bytes, nibble));
+		const __m256i high  = _mm256_shuffle_epi8(high_table, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble));
+		const __m256i none  = _mm256_cmpeq_epi8(_mm256_and_si256(low, high), _mm256_setzero_si256());
+
+		mask |= uint64_t(~uint32_t(_mm256_movemask_epi8(none))) << (32 * half);
 	}
+
+	return mask;
 }
 
 
-void transpile_to_c(std::ostream &out, const std::vector<Instruction> &program, size_t memory_size = 1000) {
-	out
-		<< "#include <stdio.h>\n\n"
-		<< "char memory[" << memory_size << "];\n\n"
-		<< "int main() {\n"
-		<< "int head = 0;\n";
+__attribute__((target("avx2")))
+uint64_t equal_avx2(const char *block, char c) {
+	const __m256i symbol = _mm256_set1_epi8(c);
+	const __m256i first  = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+	const __m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + 32));
 
-	for (Instruction I : program) {
-		switch (I.opcode) {
-			case '+': out << "memory[head] += "	<< I.operand << ";"	; break;
-			case '-': out << "memory[head] -= "	<< I.operand << ";"	; break;
-			case '<': out << "head -= "		<< I.operand << ";"	; break;
-			case '>': out << "head += "		<< I.operand << ";"	; break;
-			case ',': out << "memory[head] = getchar();"			; break;
-			case '.': out << "putchar(memory[head]);"			; break;
-			case '[': out << "while (memory[head] != 0) {"			; break;
-			case ']': out << "}"						; break;
-			default: assert(0);
-		}
+	return uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(first, symbol))))
+		| uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(second, symbol)))) << 32;
+}
 
-		out << std::endl;
+
+__attribute__((target("ssse3")))
+uint64_t symbols_ssse3(const char *block) {
+	const __m128i low_table  = _mm_setr_epi8(LEXER_LOW_TABLE);
+	const __m128i high_table = _mm_setr_epi8(LEXER_HIGH_TABLE);
+	const __m128i nibble     = _mm_set1_epi8(0x0f);
+	uint64_t mask = 0;
+
+	for (int quarter = 0; quarter < 4; ++quarter) {
+		const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 16 * quarter));
+		const __m128i low   = _mm_shuffle_epi8(low_table,  _mm_and_si128(bytes, nibble));
+		const __m128i high  = _mm_shuffle_epi8(high_table, _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble));
+		const __m128i none  = _mm_cmpeq_epi8(_mm_and_si128(low, high), _mm_setzero_si128());
+
+		mask |= uint64_t(~_mm_movemask_epi8(none) & 0xffff) << (16 * quarter);
 	}
 
-	out << "}\n";
+	return mask;
 }
 
 
-void compile_to_x86_asm(std::ostream &out, const std::vector<Instruction> &program) {
-	// void run(char *memory) => the memory pointer is in the register rdi
-	//
-	// for readability reasons the registers are harcoded in the generation instructions
-	// 	head_reg <-> %rax
-	// 	 val_reg <-> %rbx
+uint64_t equal_sse2(const char *block, char c) {
+	const __m128i symbol = _mm_set1_epi8(c);
+	uint64_t mask = 0;
 
-	const std::string head_reg("%rax");
-	const std::string  val_reg("%rbx");
+	for (int quarter = 0; quarter < 4; ++quarter) {
+		const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 16 * quarter));
+		mask |= uint64_t(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, symbol))) << (16 * quarter);
+	}
 
-	out
-		<< "\t.data\n"
-		<< "\t.globl run\n"
-		<< "\t.text\n"
-		<< "run:\n"
-		<< "mov  %rdi, %rax\n";
+	return mask;
+}
 
-	for (size_t i = 0; i < program.size(); ++i) {
-		const Instruction I = program[i];
+#endif
 
-		switch (I.opcode) {
-			case '+':
-				out << "mov  (%rax), %rbx\n";
-				out << "add  $" << I.operand << ", %rbx\n";
-				out << "mov  %rbx, (%rax)\n";
-				break;
 
-			case '-':
-				out << "mov  (%rax), %rbx\n";
-				out << "sub  $" << I.operand << ", %rbx\n";
-				out << "mov  %rbx, (%rax)\n";
-				break;
+LexerKernel select_lexer_kernel() {
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2")) {
+		return {symbols_avx2, equal_avx2};
+	}
 
-			case '<':
-				out << "sub  $" << I.operand << ", %rax\n";
-				break;
+	if (__builtin_cpu_supports("ssse3")) {
+		return {symbols_ssse3, equal_sse2};
+	}
+#endif
 
-			case '>':
-				out << "add  $" << I.operand << ", %rax\n";
-				break;
+	return {symbols_scalar, equal_scalar};
+}
 
-			case ',':
-				assert(0 && "Not implemented");
-				break;
 
-			case '.':
-				out << "push %rax\n";
-				out << "mov  (%rax), %rdi\n";
-				out << "call putchar\n";
-				out << "pop  %rax\n";
-				break;
+// Appends the instructions of `source` to the program, folding them with the last one when it is the same move or addition.
+// `position` is the offset of `source` in the whole program
+void lex_source(const LexerKernel &kernel, const char *source, size_t size, int position, std::vector<Instruction> &program) {
+	// the last partial block is copied in a zero padded buffer, zero is not a symbol
+	char tail[64];
+	auto block_at = [&](size_t begin) {
+		if (begin + 64 <= size) {
+			return source + begin;
+		}
 
-			case '[':
-				// exploit the fact that the label pointers are exactly the indices in the program array
-				out << ".L" << i << ":\n";
-				out << "mov  (%rax), %rbx\n";
+		memset(tail, 0, sizeof(tail));
+		memcpy(tail, source + begin, size - begin);
+		return static_cast<const char *>(tail);
+	};
 
-				// branching logic, uses only the lowest bits of rbx
-				out << "cmp  $0, %bl\n";
-				out << "jz   .L" << I.operand << '\n';
-				break;
+	for (size_t begin = 0; begin < size; begin += 64) {
+		const char *block = block_at(begin);
+		uint64_t mask = kernel.symbols(block);
 
-			case ']':
-				out << "jmp  .L" << I.operand << '\n';
-				out << ".L" << i << ":\n";
-				break;
+		while (mask != 0) {
+			const int  i      = __builtin_ctzll(mask);
+			const char symbol = block[i];
+
+			if (strchr("+-<>", symbol) == NULL) {
+				program.push_back({position + int(begin + i), symbol, 1});
+				mask &= mask - 1;
+				continue;
+			}
+
+			// the run ends at the first different symbol in the block, if there is one
+			const uint64_t same  = kernel.equal(block, symbol) & mask;
+			const uint64_t other = mask & ~same;
+			const uint64_t run   = other == 0 ? same : same & ((other & -other) - 1);
+			const int      count = __builtin_popcountll(run);
+
+			if (not program.empty() and program.back().opcode == symbol) {
+				program.back().operand += count;
+			}
+			else {
+				program.push_back({position + int(begin + i), symbol, count});
+			}
+
+			mask &= ~run;
 		}
 	}
+}
+
+
+std::vector<Instruction> load_program_source(const char *source, size_t size) {
+	const LexerKernel kernel = select_lexer_kernel();
+	std::vector<Instruction> program;
+
+	// the number of symbols is an upper bound of the number of instructions
+	size_t symbols = 0;
+	for (size_t begin = 0; begin + 64 <= size; begin += 64) {
+		symbols += __builtin_popcountll(kernel.symbols(source + begin));
+	}
 
-	out << "ret" << std::endl;
+	program.reserve(symbols + size % 64);
+	lex_source(kernel, source, size, 0, program);
+	return program;
 }
 
 
-void compile_to_arm_asm(std::ostream &out, const std::vector<Instruction> &program) {
-	// void run(char *memory) => the memory pointer is in the register rdi
-	//
-	// for readability reasons the registers are harcoded in the generation instructions
-	// 	head_reg <-> r0
-	// 	 val_reg <-> r1
-	const std::string head_reg{"r0"};
-	const std::string  val_reg{"r1"};
+// Maps the file and lexes it with the vectorized loader, falls back to the stream based one
+// when the file can't be mapped (empty files, pipes)
+std::vector<Instruction> load_program_file(const char *path) {
+	const int fd = open(path, O_RDONLY);
 
+	if (fd < 0) {
+		std::cerr << "Cannot open " << path << std::endl;
+		exit(1);
+	}
 
-	out
-		<< "\t.globl run\n"
-		<< "\t.text\n"
-		<< "run:\n"
-		<< "push  {fp, lr}\n";
+	struct stat info;
+	void *source = MAP_FAILED;
 
-	for (size_t i = 0; i < program.size(); ++i) {
-		const Instruction I = program[i];
+	if (fstat(fd, &info) == 0 and S_ISREG(info.st_mode) and info.st_size > 0) {
+		source = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
 
-		switch (I.opcode) {
-			case '+':
-				out << "ldr  r1, [r0]\n";
-				out << "add  r1, #" << I.operand << '\n';
-				out << "strb r1, [r0]\n";
-				break;
+	if (source == MAP_FAILED) {
+		close(fd);
+		std::ifstream in(path);
+		return load_program_source(in);
+	}
 
-			case '-':
-				out << "ldr  r1, [r0]\n";
-				out << "sub  r1, #" << I.operand << '\n';
-				out << "strb r1, [r0]\n";
-				break;
+	madvise(source, info.st_size, MADV_SEQUENTIAL);
+	std::vector<Instruction> program = load_program_source(static_cast<const char *>(source), info.st_size);
 
-			case '<':
-				out << "sub  r0, #" << I.operand << '\n';
-				break;
+	munmap(source, info.st_size);
+	close(fd);
+	return program;
+}
 
-			case '>':
-				out << "add  r0, #" << I.operand << '\n';
-				break;
 
-			case ',':
-				assert(0 && "Not implemented");
-				break;
+// The program as an input range that is lexed while it's being read: only one block of the source
+// and the instructions lexed from it are kept in memory. The last instruction of each block is held back,
+// because the next block could continue its run. Unbalanced brackets are reported (and the process exits)
+// as soon as they are found, so the backends that consume the stream only need a stack of the open loops
+class StreamingProgram {
+public:
+	explicit StreamingProgram(std::istream &in) : in(in), kernel(select_lexer_kernel()) {
+		refill();
+	}
 
-			case '.':
-				out << "push {r0}\n";
-				out << "ldr  r0, [r0]\n";
-				out << "bl putchar\n";
-				out << "pop  {r0}\n";
-				break;
+	struct iterator {
+		StreamingProgram *program;
 
-			case '[':
-				// exploit the fact that the label pointers are exactly the indices in the program array
-				out << ".L" << i << ":\n";
-				out << "ldr  r1, [r0]\n";
+		const Instruction &operator*() const { return program->pending[program->next]; }
+		iterator &operator++() {
+			program->advance();
+			program = program->done() ? nullptr : program;
+			return *this;
+		}
 
-				out << "and  r1, #255\n";
-				out << "cmp  r1, #0\n";
-				out << "beq  .L" << I.operand << '\n';
-				break;
+		bool operator!=(const iterator &other) const { return program != other.program; }
+	};
 
-			case ']':
-				out << "b  .L" << I.operand << '\n';
-				out << ".L" << i << ":\n";
-				break;
+	iterator begin() { return {done() ? nullptr : this}; }
+	iterator end()   { return {nullptr}; }
+
+private:
+	static const size_t block_size = 1 << 16;
+
+	std::istream &in;
+	LexerKernel kernel;
+	std::vector<char> buffer = std::vector<char>(block_size);
+	std::vector<Instruction> pending;
+	size_t next     = 0;
+	size_t consumed = 0;	// bytes of the source lexed so far
+	bool   last_block = false;
+	std::vector<int> open_loops;	// positions, to report the first unclosed one
+
+	bool done() const { return next >= pending.size(); }
+
+	// instructions up to `available` can be consumed, the one after may still grow
+	size_t available() const { return last_block ? pending.size() : pending.size() - 1; }
+
+	void refill() {
+		while (not last_block and next + 1 >= pending.size()) {
+			// keeps the instruction that was held back
+			pending.erase(pending.begin(), pending.begin() + next);
+			next = 0;
+
+			in.read(buffer.data(), buffer.size());
+			const size_t size = in.gcount();
+			last_block = size < buffer.size();
+
+			lex_source(kernel, buffer.data(), size, consumed, pending);
+			consumed += size;
+		}
+
+		if (next < available()) {
+			check(pending[next]);
+		}
+		else {
+			next = pending.size();
+
+			if (not open_loops.empty()) {
+				std::cerr << "Unclosed parenthesis at " << open_loops.front() << std::endl;
+				exit(1);
+			}
+		}
+	}
+
+	void advance() {
+		++next;
+		refill();
+	}
+
+	void check(const Instruction &I) {
+		if (I.opcode == '[') {
+			open_loops.push_back(I.position);
+		}
+		else if (I.opcode == ']') {
+			if (open_loops.empty()) {
+				std::cerr << "Unexpected closed parenthesis at " << I.position << std::endl;
+				exit(1);
+			}
+
+			open_loops.pop_back();
 		}
 	}
+};
+
+// Binary IR (.bfo): a header followed by the optimized instructions as they are laid out in memory,
+// jump table included. The jump targets are indices, so the file is position independent and
+// it's executed by mapping it, without any parsing. Files written by a different build (version,
+// layout of Instruction) are rejected, their contents are otherwise trusted
+struct IrHeader {
+	char     magic[4];
+	uint32_t version;
+	uint32_t instruction_size;
+	uint32_t reserved;
+	uint64_t count;
+};
+
+const char     ir_magic[4] = {'B', 'F', 'O', '\0'};
+const uint32_t ir_version  = 1;
+
+
+void write_ir(std::ostream &out, const std::vector<Instruction> &program) {
+	IrHeader header = {};
+
+	memcpy(header.magic, ir_magic, sizeof(ir_magic));
+	header.version          = ir_version;
+	header.instruction_size = sizeof(Instruction);
+	header.count            = program.size();
+
+	// copies through a zeroed array so that the padding of Instruction doesn't leak into the file
+	std::vector<unsigned char> instructions(program.size() * sizeof(Instruction));
+	for (size_t i = 0; i < program.size(); ++i) {
+		Instruction *I = reinterpret_cast<Instruction *>(instructions.data() + i * sizeof(Instruction));
+
+		I->position = program[i].position;
+		I->opcode   = program[i].opcode;
+		I->operand  = program[i].operand;
+		I->offset   = program[i].offset;
+		I->source   = program[i].source;
+	}
 
-	out << "pop  {fp, pc}" << std::endl;
+	out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char *>(instructions.data()), instructions.size());
 }
 
 
-int main(int argc, char *argv[]) {
-	if (argc < 3) {
-		std::cerr << "Usage        bf program.b \"input stream\"" << std::endl;
-		std::cerr << "Alternative  bf program.b -" << std::endl;
-		return 1;
+// Returns the instructions of a .bfo file mapped in memory, or nullptr if the file is not one.
+// The mapping lives as long as the process
+const Instruction *map_ir_file(const char *path, size_t &size) {
+	const int fd = open(path, O_RDONLY);
+	struct stat info;
+
+	if (fd < 0 or fstat(fd, &info) != 0 or not S_ISREG(info.st_mode) or static_cast<size_t>(info.st_size) < sizeof(IrHeader)) {
+		if (fd >= 0) close(fd);
+		return nullptr;
+	}
+
+	void *file = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (file == MAP_FAILED) {
+		return nullptr;
 	}
 
+	const IrHeader *header = static_cast<const IrHeader *>(file);
+
+	if (memcmp(header->magic, ir_magic, sizeof(ir_magic)) != 0) {
+		munmap(file, info.st_size);
+		return nullptr;
+	}
+
+	if (header->version != ir_version or header->instruction_size != sizeof(Instruction) or header->count > (info.st_size - sizeof(IrHeader)) / sizeof(Instruction)) {
+		std::cerr << "Incompatible or truncated IR file " << path << std::endl;
+		exit(1);
+	}
+
+	size = header->count;
+	return reinterpret_cast<const Instruction *>(header + 1);
+}
+
+
+
+// Brackets are unbalanced either because a ']' has no '[' to close, which is found while scanning,
+// or because some '[' are still open at the end: then the first of them is reported
+bool report_unbalanced(const std::vector<Instruction> &program, size_t unexpected_close, size_t unclosed_open) {
+	if (unexpected_close != SIZE_MAX) {
+		std::cerr << "Unexpected closed parenthesis at " << program[unexpected_close].position << std::endl;
+		return false;
+	}
+
+	if (unclosed_open != SIZE_MAX) {
+		std::cerr << "Unclosed parenthesis at " << program[unclosed_open].position << std::endl;
+		return false;
+	}
+
+	return true;
+}
 
-	std::ifstream in(argv[1]);
-	std::vector<Instruction> program = load_program_source(in);
-	build_jump_table(program);
 
+bool build_jump_table_sequential(std::vector<Instruction> &program) {
+	std::stack<size_t> call_stack;
 
-	if (argc > 3) {
-		if (strcmp(argv[3], "--transpile") == 0) {
-			transpile_to_c(std::cout, program);
+	for (size_t i = 0; i < program.size(); ++i) {
+		if (program[i].opcode == '[') {
+			call_stack.push(i);
 		}
-		else if (strcmp(argv[3], "--compile_to_x86") == 0) {
-			compile_to_x86_asm(std::cout, program);
+		else if (program[i].opcode == ']') {
+			if (call_stack.empty()) {
+				return report_unbalanced(program, i, SIZE_MAX);
+			}
+
+			program[i].operand = call_stack.top();
+			program[call_stack.top()].operand = i;
+			call_stack.pop();
 		}
-		else if (strcmp(argv[3], "--compile_to_arm") == 0) {
-			compile_to_arm_asm(std::cout, program);
+	}
+
+	while (call_stack.size() > 1) {
+		call_stack.pop();
+	}
+
+	return report_unbalanced(program, SIZE_MAX, call_stack.empty() ? SIZE_MAX : call_stack.top());
+}
+
+
+// Every thread matches the brackets inside its own chunk, which fills the jump targets of all the pairs
+// that don't cross a chunk boundary. What is left is, for every chunk, a list of unmatched ']' followed
+// by a list of unmatched '[': the merge step goes through them in program order with a single stack,
+// so the result (and the first error) is the same of the sequential scan
+bool build_jump_table_parallel(std::vector<Instruction> &program, unsigned threads) {
+	struct Unmatched {
+		std::vector<size_t> closes;
+		std::vector<size_t> opens;
+	};
+
+	const size_t chunk = (program.size() + threads - 1) / threads;
+	std::vector<Unmatched> unmatched(threads);
+	std::vector<std::thread> workers;
+
+	for (unsigned t = 0; t < threads; ++t) {
+		workers.emplace_back([&, t]() {
+			const size_t begin = std::min(program.size(), t * chunk);
+			const size_t end   = std::min(program.size(), begin + chunk);
+			Unmatched &local = unmatched[t];
+
+			for (size_t i = begin; i < end; ++i) {
+				if (program[i].opcode == '[') {
+					local.opens.push_back(i);
+				}
+				else if (program[i].opcode == ']') {
+					if (local.opens.empty()) {
+						local.closes.push_back(i);
+						continue;
+					}
+
+					program[i].operand = local.opens.back();
+					program[local.opens.back()].operand = i;
+					local.opens.pop_back();
+				}
+			}
+		});
+	}
+
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+
+	std::vector<size_t> call_stack;
+
+	for (const Unmatched &local : unmatched) {
+		for (size_t i : local.closes) {
+			if (call_stack.empty()) {
+				return report_unbalanced(program, i, SIZE_MAX);
+			}
+
+			program[i].operand = call_stack.back();
+			program[call_stack.back()].operand = i;
+			call_stack.pop_back();
 		}
+
+		call_stack.insert(call_stack.end(), local.opens.begin(), local.opens.end());
 	}
 
-	else {
-		run(std::cin, std::cout, program);
+	return report_unbalanced(program, SIZE_MAX, call_stack.empty() ? SIZE_MAX : call_stack.front());
+}
+
+
+// Fills the operands of the brackets with the index of the matching one, returns false (after printing
+// the position of the first error) when the brackets are unbalanced
+bool build_jump_table(std::vector<Instruction> &program) {
+	const unsigned threads = std::thread::hardware_concurrency();
+
+	// below a million instructions spawning the threads costs more than the scan
+	if (threads < 2 or program.size() < (1 << 20)) {
+		return build_jump_table_sequential(program);
+	}
+
+	return build_jump_table_parallel(program, threads);
+}
+
+
+// Intermediate representation between the parser and the backends: a tree where every block is a sequence
+// of straight line operations and loops, whose bodies are blocks themselves.
+// Unlike Instruction, operations address cells relative to the head, so that the optimizer can get rid of moves
+enum class Op { Add, Move, Input, Output, Clear, MulAdd, Loop };
+
+
+struct Node {
+	Op  op;
+	int position;
+	int value  = 0;		// Add: delta, Move: distance, MulAdd: coefficient
+	int offset = 0;		// cell affected by the operation, relative to the head
+	int source = 0;		// MulAdd: cell[offset] += cell[source] * value
+	std::vector<Node> body = {};	// Loop only, the test is always on the cell under the head
+};
+
+
+using Block = std::vector<Node>;
+
+
+Block build_ir(const std::vector<Instruction> &program) {
+	std::stack<Block> blocks;
+	std::stack<int>   loop_positions;
+	blocks.push({});
+
+	for (const Instruction &I : program) {
+		switch (I.opcode) {
+			case '+': blocks.top().push_back({Op::Add,    I.position,  I.operand});	break;
+			case '-': blocks.top().push_back({Op::Add,    I.position, -I.operand});	break;
+			case '>': blocks.top().push_back({Op::Move,   I.position,  I.operand});	break;
+			case '<': blocks.top().push_back({Op::Move,   I.position, -I.operand});	break;
+			case ',': blocks.top().push_back({Op::Input,  I.position});		break;
+			case '.': blocks.top().push_back({Op::Output, I.position});		break;
+
+			case '[':
+				blocks.push({});
+				loop_positions.push(I.position);
+				break;
+
+			case ']': {
+				// unbalanced brackets are reported by build_jump_table
+				if (loop_positions.empty()) {
+					break;
+				}
+
+				Node loop{Op::Loop, loop_positions.top()};
+				loop.body = std::move(blocks.top());
+				blocks.pop();
+				loop_positions.pop();
+				blocks.top().push_back(std::move(loop));
+				break;
+			}
+		}
+	}
+
+	while (blocks.size() > 1) {
+		blocks.pop();
+	}
+
+	return blocks.top();
+}
+
+
+void lower_ir(const Block &block, std::vector<Instruction> &program) {
+	for (const Node &node : block) {
+		switch (node.op) {
+			case Op::Add:
+				program.push_back({node.position, node.value > 0 ? '+' : '-', std::abs(node.value), node.offset});
+				break;
+
+			case Op::Move:
+				program.push_back({node.position, node.value > 0 ? '>' : '<', std::abs(node.value)});
+				break;
+
+			case Op::Input:  program.push_back({node.position, ',', 1, node.offset});			break;
+			case Op::Output: program.push_back({node.position, '.', 1, node.offset});			break;
+			case Op::Clear:  program.push_back({node.position, 'z', 0, node.offset});			break;
+			case Op::MulAdd: program.push_back({node.position, '*', node.value, node.offset, node.source});	break;
+
+			case Op::Loop:
+				// the jump targets are filled by build_jump_table
+				program.push_back({node.position, '[', 0});
+				lower_ir(node.body, program);
+				program.push_back({node.position, ']', 0});
+				break;
+		}
+	}
+}
+
+
+// Merges consecutive additions to the same cell and consecutive moves, then drops the ones that cancel out
+void fold_pass(Block &block) {
+	Block result;
+
+	for (Node &node : block) {
+		if (node.op == Op::Loop) {
+			fold_pass(node.body);
+		}
+
+		if (not result.empty() and (node.op == Op::Add or node.op == Op::Move)
+			and result.back().op == node.op and result.back().offset == node.offset) {
+			result.back().value += node.value;
+		}
+		else {
+			result.push_back(std::move(node));
+		}
+
+		if ((result.back().op == Op::Add or result.back().op == Op::Move) and result.back().value == 0) {
+			result.pop_back();
+		}
+	}
+
+	block = std::move(result);
+}
+
+
+// [-] and [+] (more generally any odd step) clear the cell
+void clear_pass(Block &block) {
+	for (Node &node : block) {
+		if (node.op != Op::Loop) {
+			continue;
+		}
+
+		clear_pass(node.body);
+
+		if (node.body.size() == 1 and node.body[0].op == Op::Add and node.body[0].offset == 0 and node.body[0].value % 2 != 0) {
+			node = {Op::Clear, node.position};
+		}
+	}
+}
+
+
+// Recognizes loops like [->+>++<<] whose body only contains additions and moves, doesn't move the head overall
+// and changes the tested cell by exactly -1 or +1 per iteration. Such a loop is equivalent to adding
+// a multiple of the tested cell to its neighbours and then clearing it, which is done in a single iteration
+void linear_loop_pass(Block &block) {
+	Block result;
+
+	for (Node &node : block) {
+		if (node.op != Op::Loop) {
+			result.push_back(std::move(node));
+			continue;
+		}
+
+		linear_loop_pass(node.body);
+
+		std::map<int, int> delta;
+		int  head   = 0;
+		bool linear = true;
+
+		for (const Node &child : node.body) {
+			switch (child.op) {
+				case Op::Add:  delta[head + child.offset] += child.value;	break;
+				case Op::Move: head += child.value;				break;
+				default: linear = false;
+			}
+		}
+
+		// with a +1 counter the loop runs (2^n - x) times, which is -x modulo the 2^n of any cell width
+		int factor = 0;
+		switch (delta[0]) {
+			case -1: factor =  1; break;
+			case  1: factor = -1; break;
+		}
+
+		if (not linear or head != 0 or factor == 0) {
+			result.push_back(std::move(node));
+			continue;
+		}
+
+		Block body;
+
+		for (const auto &[target, coefficient] : delta) {
+			if (target != 0 and coefficient != 0) {
+				body.push_back({Op::MulAdd, node.position, coefficient * factor, target, 0});
+			}
+		}
+
+		body.push_back({Op::Clear, node.position});
+
+		// the loop stays as a guard that runs at most once: when the tested cell is zero
+		// the original loop never touched the neighbours, which could even be outside of the memory
+		if (body.size() == 1) {
+			result.push_back(std::move(body[0]));
+		}
+		else {
+			node.body = std::move(body);
+			result.push_back(std::move(node));
+		}
+	}
+
+	block = std::move(result);
+}
+
+
+// Moves become offsets of the following operations, the head is only updated before loop tests
+void offset_pass(Block &block) {
+	Block result;
+	int pending = 0;
+
+	auto flush = [&](int position) {
+		if (pending != 0) {
+			result.push_back({Op::Move, position, pending});
+			pending = 0;
+		}
+	};
+
+	for (Node &node : block) {
+		switch (node.op) {
+			case Op::Move:
+				pending += node.value;
+				break;
+
+			case Op::Loop:
+				flush(node.position);
+				offset_pass(node.body);
+				result.push_back(std::move(node));
+				break;
+
+			default:
+				node.offset += pending;
+				node.source += pending;
+				result.push_back(std::move(node));
+				break;
+		}
+	}
+
+	flush(block.empty() ? 0 : block.back().position);
+	block = std::move(result);
+}
+
+
+// The tested cell is zero after a loop, and the whole memory is zero when the program starts:
+// loops and clears that are known to find a zero are removed
+void zero_pass(Block &block, bool all_zero, bool head_zero) {
+	Block result;
+
+	for (Node &node : block) {
+		if (node.op == Op::Loop) {
+			if (head_zero) {
+				continue;
+			}
+
+			zero_pass(node.body, false, false);
+			head_zero = true;
+		}
+		else if (node.op == Op::Clear and node.offset == 0 and head_zero) {
+			continue;
+		}
+		else if (node.op == Op::Move) {
+			head_zero = all_zero;
+		}
+		else if (node.op == Op::Clear and node.offset == 0) {
+			head_zero = true;
+		}
+		else if (node.op != Op::Output and node.op != Op::Clear) {
+			all_zero  = false;
+			head_zero = head_zero and node.offset != 0;
+		}
+
+		result.push_back(std::move(node));
+	}
+
+	block = std::move(result);
+}
+
+
+// A block either starts the program, or (when it's optimized on its own by optimize_incremental)
+// follows a top-level loop, so that at least its tested cell is known to be zero
+struct Pass {
+	const char *name;
+	void (*run)(Block &, bool program_start);
+};
+
+
+const std::vector<Pass> available_passes = {
+	{"fold",   [](Block &block, bool) { fold_pass(block); }},
+	{"clear",  [](Block &block, bool) { clear_pass(block); }},
+	{"linear", [](Block &block, bool) { linear_loop_pass(block); }},
+	{"offset", [](Block &block, bool) { offset_pass(block); }},
+	{"zero",   [](Block &block, bool program_start) { zero_pass(block, program_start, true); }},
+};
+
+
+const Pass &find_pass(const std::string &name) {
+	for (const Pass &pass : available_passes) {
+		if (name == pass.name) {
+			return pass;
+		}
+	}
+
+	std::cerr << "Unknown optimization pass " << name << std::endl;
+	exit(1);
+}
+
+
+// The pipeline is an ordered list of pass names, either chosen with -O0..-O3 or given explicitly with --passes=a,b,c
+std::vector<std::string> optimization_pipeline(int level) {
+	switch (level) {
+		case 0:  return {};
+		case 1:  return {"fold", "clear"};
+		case 2:  return {"fold", "clear", "linear", "offset", "fold"};
+		default: return {"fold", "clear", "linear", "offset", "zero", "fold"};
+	}
+}
+
+
+// Cost and effect of every stage of the compilation, collected with --stats
+struct StageStatistics {
+	std::string name;
+	double milliseconds;
+	size_t ops_before;
+	size_t ops_after;
+	size_t loops_before;
+	size_t loops_after;
+	long   peak_memory_kb;
+};
+
+
+using Statistics = std::vector<StageStatistics>;
+
+
+size_t count_ops(const Block &block) {
+	size_t result = 0;
+
+	for (const Node &node : block) {
+		result += 1 + count_ops(node.body);
+	}
+
+	return result;
+}
+
+
+size_t count_loops(const Block &block) {
+	size_t result = 0;
+
+	for (const Node &node : block) {
+		result += (node.op == Op::Loop) + count_loops(node.body);
+	}
+
+	return result;
+}
+
+
+size_t count_loops(const std::vector<Instruction> &program) {
+	return std::count_if(program.begin(), program.end(), [](const Instruction &I) { return I.opcode == '['; });
+}
+
+
+long peak_memory_kb() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+
+double milliseconds_since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+void run_passes(Block &ir, const std::vector<std::string> &pipeline, Statistics *statistics = nullptr, bool program_start = true) {
+	for (const std::string &name : pipeline) {
+		const size_t ops   = statistics ? count_ops(ir)   : 0;
+		const size_t loops = statistics ? count_loops(ir) : 0;
+		const auto   start = std::chrono::steady_clock::now();
+
+		find_pass(name).run(ir, program_start);
+
+		if (statistics) {
+			statistics->push_back({name, milliseconds_since(start), ops, count_ops(ir), loops, count_loops(ir), peak_memory_kb()});
+		}
+	}
+}
+
+
+// Regions of a program with its jump table: the straight line code before a top-level loop and the loop itself,
+// plus the code after the last loop. The passes never need to look past a top-level loop, except for zero_pass
+// which only loses what it knew about the cells other than the head, so the regions are optimized independently
+std::vector<std::pair<size_t, size_t>> split_regions(const std::vector<Instruction> &program) {
+	std::vector<std::pair<size_t, size_t>> regions;
+
+	for (size_t begin = 0; begin < program.size(); ) {
+		size_t end = begin;
+
+		while (end < program.size() and program[end].opcode != '[') {
+			++end;
+		}
+
+		end = end < program.size() ? program[end].operand + 1 : end;
+		regions.push_back({begin, end});
+		begin = end;
+	}
+
+	return regions;
+}
+
+
+// The optimizer on a single region: lifted to the IR, optimized and lowered back, without jump targets
+std::vector<Instruction> optimize_region(const std::vector<Instruction> &program, size_t begin, size_t end, const std::vector<std::string> &pipeline, Statistics *statistics = nullptr) {
+	Block ir = build_ir(std::vector<Instruction>(program.begin() + begin, program.begin() + end));
+	run_passes(ir, pipeline, statistics, begin == 0);
+
+	std::vector<Instruction> result;
+	lower_ir(ir, result);
+	return result;
+}
+
+
+// Calls task(i) for every i < count on up to `threads` threads. Every thread starts with an equal share of
+// the indices and, once it's done with its own, steals the upper half of the share of another thread
+template <typename Task>
+void parallel_for(size_t count, unsigned threads, const Task &task) {
+	threads = std::min<size_t>(threads, count);
+
+	if (threads < 2) {
+		for (size_t i = 0; i < count; ++i) {
+			task(i);
+		}
+
+		return;
+	}
+
+	struct Share {
+		std::mutex lock;
+		size_t begin = 0;
+		size_t end   = 0;
+	};
+
+	std::vector<Share> shares(threads);
+	for (unsigned t = 0; t < threads; ++t) {
+		shares[t].begin = count * t / threads;
+		shares[t].end   = count * (t + 1) / threads;
+	}
+
+	auto next = [&](unsigned self, size_t &index) {
+		{
+			std::lock_guard<std::mutex> guard(shares[self].lock);
+
+			if (shares[self].begin < shares[self].end) {
+				index = shares[self].begin++;
+				return true;
+			}
+		}
+
+		for (unsigned k = 1; k < threads; ++k) {
+			Share &victim = shares[(self + k) % threads];
+			size_t begin;
+			size_t end;
+
+			{
+				std::lock_guard<std::mutex> guard(victim.lock);
+
+				if (victim.begin >= victim.end) {
+					continue;
+				}
+
+				begin = victim.begin + (victim.end - victim.begin) / 2;
+				end   = victim.end;
+				victim.end = begin;
+			}
+
+			std::lock_guard<std::mutex> guard(shares[self].lock);
+			index = begin;
+			shares[self].begin = begin + 1;
+			shares[self].end   = end;
+			return true;
+		}
+
+		return false;
+	};
+
+	std::vector<std::thread> workers;
+
+	for (unsigned t = 0; t < threads; ++t) {
+		workers.emplace_back([&, t]() {
+			size_t index;
+
+			while (next(t, index)) {
+				task(index);
+			}
+		});
+	}
+
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+}
+
+
+// Threads used to optimize the regions, small programs are optimized on the calling thread
+unsigned optimizer_threads(const std::vector<Instruction> &program) {
+	return program.size() < (1 << 16) ? 1 : std::thread::hardware_concurrency();
+}
+
+
+// Adds up the statistics of the regions, pass by pass. The time is the sum over the threads
+void merge_statistics(const std::vector<Statistics> &regions, Statistics &statistics) {
+	Statistics total;
+
+	for (const Statistics &region : regions) {
+		total.resize(std::max(total.size(), region.size()));
+
+		for (size_t i = 0; i < region.size(); ++i) {
+			total[i].name            = region[i].name;
+			total[i].milliseconds   += region[i].milliseconds;
+			total[i].ops_before     += region[i].ops_before;
+			total[i].ops_after      += region[i].ops_after;
+			total[i].loops_before   += region[i].loops_before;
+			total[i].loops_after    += region[i].loops_after;
+			total[i].peak_memory_kb  = std::max(total[i].peak_memory_kb, region[i].peak_memory_kb);
+		}
+	}
+
+	statistics.insert(statistics.end(), total.begin(), total.end());
+}
+
+
+// The whole optimizer as seen by main: the regions are optimized in parallel and concatenated in order,
+// so the result doesn't depend on the number of threads. `program` must have its jump table,
+// the new jump targets are then filled by build_jump_table
+std::vector<Instruction> optimize(const std::vector<Instruction> &program, const std::vector<std::string> &pipeline, Statistics *statistics = nullptr) {
+	const std::vector<std::pair<size_t, size_t>> regions = split_regions(program);
+	std::vector<std::vector<Instruction>> optimized(regions.size());
+	std::vector<Statistics> region_statistics(regions.size());
+
+	parallel_for(regions.size(), optimizer_threads(program), [&](size_t i) {
+		optimized[i] = optimize_region(program, regions[i].first, regions[i].second, pipeline, statistics ? &region_statistics[i] : nullptr);
+	});
+
+	if (statistics) {
+		merge_statistics(region_statistics, *statistics);
+	}
+
+	std::vector<Instruction> result;
+	result.reserve(program.size());
+
+	for (const std::vector<Instruction> &region : optimized) {
+		result.insert(result.end(), region.begin(), region.end());
+	}
+
+	return result;
+}
+
+
+void print_statistics(std::ostream &out, const Statistics &statistics, bool json) {
+	if (json) {
+		out << "[\n";
+
+		for (size_t i = 0; i < statistics.size(); ++i) {
+			const StageStatistics &s = statistics[i];
+
+			out
+				<< "  {\"name\": \"" << s.name << "\""
+				<< ", \"milliseconds\": " << s.milliseconds
+				<< ", \"ops_before\": " << s.ops_before
+				<< ", \"ops_after\": " << s.ops_after
+				<< ", \"loops_before\": " << s.loops_before
+				<< ", \"loops_after\": " << s.loops_after
+				<< ", \"peak_memory_kb\": " << s.peak_memory_kb
+				<< "}" << (i + 1 < statistics.size() ? "," : "") << '\n';
+		}
+
+		out << "]" << std::endl;
+		return;
+	}
+
+	char line[256];
+
+	snprintf(line, sizeof(line), "%-20s %10s %12s %12s %14s %12s\n", "stage", "time [ms]", "ops before", "ops after", "loops removed", "peak [KB]");
+	out << line;
+
+	double total = 0;
+
+	for (const StageStatistics &s : statistics) {
+		snprintf(line, sizeof(line), "%-20s %10.3f %12zu %12zu %14ld %12ld\n",
+			s.name.c_str(), s.milliseconds, s.ops_before, s.ops_after, long(s.loops_before) - long(s.loops_after), s.peak_memory_kb);
+		out << line;
+		total += s.milliseconds;
+	}
+
+	snprintf(line, sizeof(line), "%-20s %10.3f\n", "total", total);
+	out << line;
+}
+
+
+// Tape of the interpreter: `reach` cells on both sides of the starting one are reserved, without swap space,
+// and the kernel commits the pages on first touch, so small programs stay small and large ones just work.
+// The reservation is mapped between two PROT_NONE guard regions larger than any move plus offset
+// (both are 32 bit), so running off either end faults instead of corrupting memory and no move needs a check.
+// A SIGSEGV inside a guard is reported with the source position of the instruction being executed,
+// any other one keeps its default behaviour
+const size_t tape_guard = size_t(1) << 32;
+const size_t tape_reach = size_t(1) << 28;
+
+
+// Backing of the tape and of the program of the interpreter. Explicit huge pages come from the pool reserved
+// for hugetlbfs (vm.nr_hugepages) and are committed by the mapping, transparent ones are an advice to the kernel,
+// which can assemble them on first touch. Every policy falls back to the next one when it isn't available
+enum class HugePages { Off, Transparent, Explicit };
+
+const size_t huge_page = 2 << 20;
+
+
+const char *huge_pages_name(HugePages policy) {
+	switch (policy) {
+		case HugePages::Transparent: return "transparent";
+		case HugePages::Explicit:    return "explicit";
+		default:                     return "off";
+	}
+}
+
+
+// Inaccessible reservation of `length` bytes aligned to a huge page, the unaligned ends are given back
+char *reserve_aligned(size_t length) {
+	void *mapping = mmap(nullptr, length + huge_page, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if (mapping == MAP_FAILED) {
+		return nullptr;
+	}
+
+	char *begin = static_cast<char *>(mapping);
+	char *aligned = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(begin) + huge_page - 1) & ~(huge_page - 1));
+
+	if (aligned > begin) {
+		munmap(begin, aligned - begin);
+	}
+
+	munmap(aligned + length, begin + huge_page - aligned);
+	return aligned;
+}
+
+
+// Maps `length` readable and writable bytes at `address`, inside a reservation and aligned to a huge page,
+// and returns the backing it got. A failed hugetlb mapping can leave a hole, so the plain one is mapped over it
+HugePages map_pages(char *address, size_t length, HugePages policy) {
+	if (policy == HugePages::Explicit
+		and mmap(address, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0) != MAP_FAILED) {
+		return HugePages::Explicit;
+	}
+
+	if (mmap(address, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0) == MAP_FAILED) {
+		std::cerr << "Cannot allocate the tape" << std::endl;
+		exit(1);
+	}
+
+	if (policy != HugePages::Off and madvise(address, length, MADV_HUGEPAGE) == 0) {
+		return HugePages::Transparent;
+	}
+
+	return HugePages::Off;
+}
+
+
+// Lowest and highest cell whose page was touched, relative to the starting cell, and committed memory
+struct TapeUsage {
+	long lowest  = 0;
+	long highest = 0;
+	size_t committed_kb = 0;
+	HugePages backing = HugePages::Off;
+};
+
+
+struct GuardedTape {
+	char *base  = nullptr;
+	char *cells = nullptr;	// the starting cell, in the middle of the reservation
+	size_t reach = 0;	// in bytes, as the guard
+	size_t guard = 0;
+	HugePages policy  = HugePages::Off;	// the requested one
+	HugePages backing = HugePages::Off;	// the one in place
+
+	GuardedTape(size_t reach, size_t guard, HugePages policy = HugePages::Off);
+	~GuardedTape();
+
+	TapeUsage usage(long lowest, long highest) const;
+
+	// snapshots of the cells, see run_snapshot
+	int file = -1;
+	bool share();
+	bool restore();
+
+	GuardedTape(const GuardedTape&) = delete;
+	GuardedTape &operator=(const GuardedTape&) = delete;
+};
+
+
+// read by the signal handler, the interpreter publishes the instruction before executing it
+const GuardedTape *volatile guarded_tape = nullptr;
+const Instruction *volatile executing    = nullptr;
+
+
+void tape_fault_handler(int number, siginfo_t *info, void *) {
+	const GuardedTape *tape = guarded_tape;
+	const char *address = static_cast<const char *>(info->si_addr);
+
+	if (tape == nullptr or executing == nullptr or address < tape->base or address >= tape->cells + tape->reach + tape->guard
+		or (address >= tape->cells - tape->reach and address < tape->cells + tape->reach)) {
+		signal(number, SIG_DFL);
+		return;
+	}
+
+	// only async signal safe calls from here
+	char message[64] = "Tape overflow at source position ";
+	size_t length = strlen(message);
+
+	char digits[16];
+	int count = 0;
+
+	for (unsigned position = executing->position; count == 0 or position > 0; position /= 10) {
+		digits[count++] = '0' + position % 10;
+	}
+
+	while (count > 0) {
+		message[length++] = digits[--count];
+	}
+
+	message[length++] = '\n';
+	if (write(2, message, length) < 0) {
+		_exit(1);
+	}
+
+	_exit(1);
+}
+
+
+// The reach and the guards are whole huge pages, so that the cells can be backed by them whatever the policy
+GuardedTape::GuardedTape(size_t bytes_per_side, size_t guard_bytes, HugePages huge_pages) {
+	reach  = (bytes_per_side + huge_page - 1) / huge_page * huge_page;
+	guard  = (guard_bytes + huge_page - 1) / huge_page * huge_page;
+	policy = huge_pages;
+	base   = reserve_aligned(2 * reach + 2 * guard);
+
+	if (base == nullptr) {
+		std::cerr << "Cannot allocate the tape" << std::endl;
+		exit(1);
+	}
+
+	backing = map_pages(base + guard, 2 * reach, policy);
+	cells   = base + guard + reach;
+
+	struct sigaction action = {};
+	action.sa_sigaction = tape_fault_handler;
+	action.sa_flags     = SA_SIGINFO;
+	sigaction(SIGSEGV, &action, nullptr);
+
+	guarded_tape = this;
+}
+
+
+GuardedTape::~GuardedTape() {
+	if (guarded_tape == this) {
+		guarded_tape = nullptr;
+		executing    = nullptr;
+	}
+
+	munmap(base, 2 * reach + 2 * guard);
+
+	if (file >= 0) {
+		close(file);
+	}
+}
+
+
+// Moves the cells to a memfd, mapped shared: what is written from now on is the snapshot
+bool GuardedTape::share() {
+	file = memfd_create("tape", 0);
+
+	return file >= 0 and ftruncate(file, 2 * reach) == 0
+		and mmap(cells - reach, 2 * reach, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, file, 0) != MAP_FAILED;
+}
+
+
+// Maps the cells privately over the snapshot: the pages are shared with it until they are written, and the
+// writes since the last restore are dropped. The first restore freezes the snapshot
+bool GuardedTape::restore() {
+	return mmap(cells - reach, 2 * reach, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, file, 0) != MAP_FAILED;
+}
+
+
+// The resident pages of the reservation are the ones that were touched, as long as nothing was swapped out.
+// Only the pages between the bytes `lowest` and `highest` (relative to the starting cell) are looked at,
+// the ones that the interpreter could have touched, so that the cost follows the work done.
+// The cells are bytes here, run divides by the width of its cells
+TapeUsage GuardedTape::usage(long lowest, long highest) const {
+	const long page = sysconf(_SC_PAGESIZE);
+	const long first_page = (std::max(lowest,  -long(reach))    + long(reach)) / page;
+	const long last_page  = (std::min(highest,  long(reach) - 1) + long(reach)) / page;
+
+	std::vector<unsigned char> resident(last_page - first_page + 1);
+	TapeUsage result;
+	result.backing = backing;
+
+	if (mincore(cells - reach + first_page * page, resident.size() * page, resident.data()) != 0) {
+		return result;
+	}
+
+	size_t first = resident.size();
+	size_t last  = 0;
+	size_t count = 0;
+
+	for (size_t i = 0; i < resident.size(); ++i) {
+		if (resident[i] & 1) {
+			first = std::min(first, i);
+			last  = i;
+			++count;
+		}
+	}
+
+	if (count > 0) {
+		result.lowest  = (first_page + long(first)) * page - long(reach);
+		result.highest = (first_page + long(last) + 1) * page - long(reach) - 1;
+	}
+
+	result.committed_kb = count * page / 1024;
+	return result;
+}
+
+
+// Tapes released by the runs are kept for the next ones of the same size, for batches of executions.
+// Only the range that the run could have touched, tracked from the head by execute, is cleared (the resident
+// pages would miss the ones swapped out, whose contents would leak into the next run):
+// small ranges are zeroed in place and stay committed, the whole pages of larger ones are given back to the
+// kernel, so a run costs as much as the cells it uses, not as the reservation
+const size_t tape_zero_limit = 2 << 20;
+
+
+class TapePool {
+public:
+	std::unique_ptr<GuardedTape> acquire(size_t reach, size_t guard, HugePages policy) {
+		std::unique_ptr<GuardedTape> tape;
+
+		for (auto it = tapes.begin(); it != tapes.end(); ++it) {
+			if ((*it)->reach == reach and (*it)->guard == guard and (*it)->policy == policy) {
+				tape = std::move(*it);
+				tapes.erase(it);
+				break;
+			}
+		}
+
+		if (tape == nullptr) {
+			tape = std::make_unique<GuardedTape>(reach, guard, policy);
+		}
+
+		guarded_tape = tape.get();
+		return tape;
+	}
+
+	// `lowest` and `highest` are the bytes that the run could have touched, relative to the starting cell
+	void release(std::unique_ptr<GuardedTape> tape, long lowest, long highest) {
+		guarded_tape = nullptr;
+		executing    = nullptr;
+
+		lowest  = std::max(lowest,  -long(tape->reach));
+		highest = std::min(highest,  long(tape->reach) - 1);
+
+		if (lowest <= highest) {
+			clear(tape->cells + lowest, tape->cells + highest + 1, tape->backing == HugePages::Explicit ? huge_page : sysconf(_SC_PAGESIZE));
+		}
+
+		tapes.push_back(std::move(tape));
+	}
+
+private:
+	std::vector<std::unique_ptr<GuardedTape>> tapes;
+
+	// madvise only takes whole pages, so the partial pages at the ends are zeroed in place. It can also fail,
+	// like DONTNEED on explicit huge pages before linux 5.18, then the whole range is zeroed
+	static void clear(char *begin, char *end, size_t page) {
+		char *middle_begin = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(begin) + page - 1) & ~(page - 1));
+		char *middle_end   = reinterpret_cast<char *>(reinterpret_cast<uintptr_t>(end) & ~(page - 1));
+
+		if (size_t(end - begin) <= tape_zero_limit or middle_begin >= middle_end
+			or madvise(middle_begin, middle_end - middle_begin, MADV_DONTNEED) != 0) {
+			memset(begin, 0, end - begin);
+			return;
+		}
+
+		memset(begin, 0, middle_begin - begin);
+		memset(middle_end, 0, end - middle_end);
+	}
+};
+
+
+TapePool tape_pool;
+
+
+// High-water mark of the tape, printed after the execution with --stats
+void print_tape_usage(std::ostream &out, const TapeUsage &usage, bool json) {
+	if (json) {
+		out << "{\"tape_lowest\": " << usage.lowest << ", \"tape_highest\": " << usage.highest << ", \"tape_committed_kb\": " << usage.committed_kb;
+
+		if (usage.backing != HugePages::Off) {
+			out << ", \"tape_huge_pages\": \"" << huge_pages_name(usage.backing) << "\"";
+		}
+
+		out << "}" << std::endl;
+	}
+	else {
+		out << "tape used from cell " << usage.lowest << " to cell " << usage.highest << ", " << usage.committed_kb << " KB committed";
+
+		if (usage.backing != HugePages::Off) {
+			out << " on " << huge_pages_name(usage.backing) << " huge pages";
+		}
+
+		out << std::endl;
+	}
+}
+
+
+// Alternative tape for programs that park data millions of cells apart: fixed size chunks allocated on first
+// access, found through a hash table. The chunk of the last access is cached, so in the common case a cell
+// costs a comparison and a load. The chunks never move, references to cells stay valid. There are no bounds.
+// The ring tape has a power of two number of cells and wraps around, see RingTape
+enum class TapeKind { Dense, Sparse, Ring };
+
+
+template <typename Cell>
+class SparseTape {
+public:
+	SparseTape() {
+		select(0);
+	}
+
+	Cell &operator[](long index) {
+		if ((index >> chunk_bits) != current_number) {
+			select(index >> chunk_bits);
+		}
+
+		return current[index & chunk_mask];
+	}
+
+	TapeUsage usage() const {
+		TapeUsage result;
+
+		for (const auto &[number, chunk] : chunks) {
+			result.lowest  = std::min(result.lowest,  number << chunk_bits);
+			result.highest = std::max(result.highest, ((number + 1) << chunk_bits) - 1);
+		}
+
+		result.committed_kb = (chunks.size() << chunk_bits) * sizeof(Cell) / 1024;
+		return result;
+	}
+
+private:
+	static const int  chunk_bits = 8;
+	static const long chunk_mask = (1 << chunk_bits) - 1;
+
+	std::unordered_map<long, std::unique_ptr<Cell[]>> chunks;
+	long  current_number = 0;
+	Cell *current;
+
+	void select(long number) {
+		std::unique_ptr<Cell[]> &chunk = chunks[number];
+
+		if (chunk == nullptr) {
+			chunk = std::make_unique<Cell[]>(1 << chunk_bits);
+		}
+
+		current_number = number;
+		current        = chunk.get();
+	}
+
+};
+
+
+// Fixed size tape whose cells wrap around, the index of every access is masked so it can't leave the tape.
+// The transpiled C and the LLVM IR do the same. The assembly and machine code backends run on the ring of
+// runtime.c, mapped three times in a row, and only wrap the head around the middle copy when it moves
+template <typename Cell>
+class RingTape {
+public:
+	RingTape(size_t size) : cells(size), mask(size - 1) {}
+
+	Cell &operator[](long index) {
+		return cells[index & mask];
+	}
+
+	TapeUsage usage() const {
+		TapeUsage result;
+		result.highest      = long(cells.size()) - 1;
+		result.committed_kb = cells.size() * sizeof(Cell) / 1024;
+		return result;
+	}
+
+private:
+	std::vector<Cell> cells;
+	long mask;
+};
+
+
+// Values for the cells between the lowest and the highest one that were asked for, default constructed.
+// The range at least doubles when it grows, towards the new cell
+template <typename T>
+class CellArray {
+public:
+	T &operator[](long cell) {
+		const long size = long(values.size());
+
+		if (cell < first or cell >= first + size) {
+			const long begin = values.empty() ? cell : std::min(first, cell - (cell < first ? size : 0));
+			const long end   = values.empty() ? cell + 1 : std::max(first + size, cell + 1 + (cell >= first + size ? size : 0));
+
+			std::vector<T> grown(end - begin);
+			std::copy(values.begin(), values.end(), grown.begin() + (first - begin));
+
+			values.swap(grown);
+			first = begin;
+		}
+
+		return values[cell - first];
+	}
+
+	std::vector<T> values;	// from the cell `first` on
+	long first = 0;
+};
+
+
+// Execution without instrumentation, the calls compile to nothing.
+// `written` follows the instructions that store to a cell
+struct NoProfile {
+	void step(long) {}
+	void read(long) {}
+	void write(long) {}
+	void modify(long) {}
+
+	template <typename Cells>
+	void written(Cells &, long) {}
+};
+
+
+// Header of the binary dump written by --profile, followed by `cells` pairs of 64 bit read and write counts
+// (from `first_cell` on), by the 2 * profile_stride_limit + 1 counts of the strides (from -limit on, the ends
+// also count the longer ones) and by `epochs` histograms of the head: a 32 bit count of windows, then
+// for each one its 64 bit number (the first cell divided by profile_window) and the instructions executed in it
+struct ProfileHeader {
+	char     magic[4];
+	uint32_t version;
+	int64_t  first_cell;
+	uint64_t cells;
+	uint64_t epochs;
+	uint32_t window_cells;
+	uint32_t epoch_steps;
+};
+
+const char     profile_magic[4] = {'B', 'F', 'P', '\0'};
+const uint32_t profile_version  = 1;
+
+const int      profile_window_bits  = 6;
+const long     profile_window       = 1 << profile_window_bits;
+const uint64_t profile_epoch        = 1 << 16;
+const long     profile_stride_limit = 16;
+
+
+// Instrumentation of the interpreter for --profile: reads and writes of every cell, strides between the cells
+// of consecutive accesses and, for every epoch of profile_epoch instructions, how many ran with the head in each
+// window of profile_window cells. Cells are relative to the starting one, the indices of a ring aren't wrapped.
+// The counts add up over the runs of a batch, report writes the dump and prints the summary
+class TapeProfile {
+public:
+	TapeProfile(const char *path) : path(path), file(path, std::ios::binary), strides(2 * profile_stride_limit + 1) {}
+
+	bool good() const {
+		return bool(file);
+	}
+
+	void step(long head) {
+		const long window = head >> profile_window_bits;
+
+		if (window != head_window) {
+			flush_window();
+			head_window = window;
+		}
+
+		++head_steps;
+
+		if (++steps % profile_epoch == 0) {
+			flush_window();
+			epochs.push_back(std::move(epoch));
+			epoch.clear();
+		}
+	}
+
+	void read(long cell) {
+		access(cell);
+		++counts[cell].reads;
+	}
+
+	void write(long cell) {
+		access(cell);
+		++counts[cell].writes;
+	}
+
+	void modify(long cell) {
+		access(cell);
+		++counts[cell].reads;
+		++counts[cell].writes;
+	}
+
+	template <typename Cells>
+	void written(Cells &, long) {}
+
+	void report(std::ostream &out);
+
+private:
+	struct CellCounts {
+		uint64_t reads  = 0;
+		uint64_t writes = 0;
+	};
+
+	const char *path;
+	std::ofstream file;
+
+	CellArray<CellCounts> counts;
+
+	std::vector<uint64_t> strides;
+	long last_cell = 0;
+
+	std::vector<std::map<long, uint64_t>> epochs;
+	std::map<long, uint64_t> epoch;
+	long head_window    = 0;
+	uint64_t head_steps = 0;
+	uint64_t steps      = 0;
+
+	void access(long cell) {
+		++strides[std::clamp(cell - last_cell, -profile_stride_limit, profile_stride_limit) + profile_stride_limit];
+		last_cell = cell;
+	}
+
+	void flush_window() {
+		if (head_steps > 0) {
+			epoch[head_window] += head_steps;
+			head_steps = 0;
+		}
+	}
+
+};
+
+
+// The summary is meant to pick the programs that benefit from some tape layout: few cells taking most of the
+// accesses can live in registers, a span of touched cells much larger than its touched pages fits a sparse tape
+void TapeProfile::report(std::ostream &out) {
+	flush_window();
+	if (steps % profile_epoch != 0) {
+		epochs.push_back(std::move(epoch));
+		epoch.clear();
+	}
+
+	// the counts of the cells that were never accessed, at the ends, are left out
+	const std::vector<CellCounts> &cells = counts.values;
+	const long first = counts.first;
+
+	size_t begin = 0;
+	size_t end   = cells.size();
+
+	while (begin < end and cells[begin].reads + cells[begin].writes == 0) ++begin;
+	while (end > begin and cells[end - 1].reads + cells[end - 1].writes == 0) --end;
+
+	ProfileHeader header = {};
+	memcpy(header.magic, profile_magic, sizeof(profile_magic));
+	header.version      = profile_version;
+	header.first_cell   = first + long(begin);
+	header.cells        = end - begin;
+	header.epochs       = epochs.size();
+	header.window_cells = profile_window;
+	header.epoch_steps  = profile_epoch;
+
+	file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char *>(cells.data() + begin), (end - begin) * sizeof(CellCounts));
+	file.write(reinterpret_cast<const char *>(strides.data()), strides.size() * sizeof(uint64_t));
+
+	size_t epoch_windows = 0;
+	size_t max_windows   = 0;
+
+	for (const auto &histogram : epochs) {
+		const uint32_t count = histogram.size();
+		file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+
+		for (const auto &[window, executed] : histogram) {
+			const int64_t number = window;
+			file.write(reinterpret_cast<const char *>(&number), sizeof(number));
+			file.write(reinterpret_cast<const char *>(&executed), sizeof(executed));
+		}
+
+		epoch_windows += histogram.size();
+		max_windows    = std::max(max_windows, histogram.size());
+	}
+
+	file.flush();
+	if (not file) {
+		std::cerr << "Cannot write the profile to " << path << std::endl;
+		return;
+	}
+
+	// accesses of every cell and of every window, sorted from the hottest
+	uint64_t reads  = 0;
+	uint64_t writes = 0;
+	size_t touched  = 0;
+
+	std::vector<uint64_t> accesses;
+	std::map<long, uint64_t> window_accesses;
+	long last_page = 0;
+	long pages     = 0;
+
+	for (size_t i = begin; i < end; ++i) {
+		const long cell = first + long(i);
+		const uint64_t count = cells[i].reads + cells[i].writes;
+
+		reads  += cells[i].reads;
+		writes += cells[i].writes;
+
+		if (count > 0) {
+			++touched;
+			accesses.push_back(count);
+			window_accesses[cell >> profile_window_bits] += count;
+			pages    += touched == 1 or (cell >> 12) != last_page;
+			last_page = cell >> 12;
+		}
+	}
+
+	std::sort(accesses.begin(), accesses.end(), std::greater<uint64_t>());
+
+	const uint64_t total = reads + writes;
+	size_t hot_cells = 0;
+
+	for (uint64_t covered = 0; hot_cells < accesses.size() and covered * 10 < total * 9; ++hot_cells) {
+		covered += accesses[hot_cells];
+	}
+
+	std::vector<std::pair<uint64_t, long>> windows;
+	for (const auto &[window, count] : window_accesses) {
+		windows.push_back({count, window});
+	}
+	std::sort(windows.begin(), windows.end(), std::greater<std::pair<uint64_t, long>>());
+
+	std::vector<std::pair<uint64_t, long>> common_strides;
+	for (long stride = -profile_stride_limit; stride <= profile_stride_limit; ++stride) {
+		common_strides.push_back({strides[stride + profile_stride_limit], stride});
+	}
+	std::sort(common_strides.begin(), common_strides.end(), std::greater<std::pair<uint64_t, long>>());
+
+	auto percent = [&](uint64_t count) {
+		char text[16];
+		snprintf(text, sizeof(text), "%.1f%%", total > 0 ? 100.0 * count / total : 0.0);
+		return std::string(text);
+	};
+
+	const long span = touched > 0 ? long(end - begin) : 0;
+	const long spanned_pages = touched > 0 ? ((header.first_cell + span - 1) >> 12) - (header.first_cell >> 12) + 1 : 0;
+
+	out << "profile written to " << path << '\n';
+	out << "instructions executed    " << steps << '\n';
+	out << "cell reads / writes      " << reads << " / " << writes << '\n';
+	out << "cells touched            " << touched << ", from cell " << header.first_cell << " to cell " << header.first_cell + span - 1
+		<< ", " << pages << " of the " << spanned_pages << " pages of 4096 cells in between" << '\n';
+	out << "cells with 90% of them   " << hot_cells << '\n';
+	out << "head windows per epoch   " << (epochs.empty() ? 0 : epoch_windows / epochs.size()) << " on average, " << max_windows
+		<< " at most (windows of " << profile_window << " cells, epochs of " << profile_epoch << " instructions)" << '\n';
+
+	out << "hottest windows         ";
+	for (size_t i = 0; i < windows.size() and i < 5; ++i) {
+		out << " " << windows[i].second * profile_window << ": " << percent(windows[i].first);
+	}
+	out << '\n';
+
+	out << "commonest strides       ";
+	for (size_t i = 0; i < common_strides.size() and i < 5 and common_strides[i].first > 0; ++i) {
+		const long stride = common_strides[i].second;
+		out << " " << (stride == profile_stride_limit ? ">=" : stride == -profile_stride_limit ? "<=" : "") << stride << ": " << percent(common_strides[i].first);
+	}
+	out << '\n';
+
+	if (touched > 0 and hot_cells <= 16) {
+		out << "suggests                 register promotion, 90% of the accesses are on " << hot_cells << " cells" << '\n';
+	}
+
+	if (spanned_pages >= 16 and pages * 4 <= spanned_pages) {
+		out << "suggests                 a sparse tape, " << pages << " of " << spanned_pages << " pages are touched" << '\n';
+	}
+
+	out << std::flush;
+}
+
+
+// Values a cell may hold, both included, as unsigned numbers of the width of the cells
+struct ValueRange {
+	uint64_t lowest  = 0;
+	uint64_t highest = 0;
+
+	bool operator==(const ValueRange &other) const {
+		return lowest == other.lowest and highest == other.highest;
+	}
+};
+
+
+ValueRange join(ValueRange a, ValueRange b) {
+	return {std::min(a.lowest, b.lowest), std::max(a.highest, b.highest)};
+}
+
+
+// Adds `n` modulo the cell width, when only part of the range wraps it can hold any value
+ValueRange add_range(ValueRange range, uint64_t n, uint64_t cell_max) {
+	if (range.highest <= cell_max - n) {
+		return {range.lowest + n, range.highest + n};
+	}
+
+	if (range.lowest > cell_max - n) {
+		return {range.lowest - (cell_max - n) - 1, range.highest - (cell_max - n) - 1};
+	}
+
+	return {0, cell_max};
+}
+
+
+const size_t range_state_cells = 1024;
+
+
+// State of the analysis before an instruction: the cells are relative to the starting one, the ones that
+// aren't listed share `others`. When the head isn't known any more, an access could be to any cell
+struct RangeState {
+	bool reached    = false;
+	bool head_known = true;
+	long head       = 0;
+	std::map<long, ValueRange> cells;
+	ValueRange others;
+
+	ValueRange get(long cell) const {
+		const auto it = cells.find(cell);
+		return it != cells.end() ? it->second : others;
+	}
+
+	// every cell the head can point to, all of them if it isn't known
+	ValueRange any(int offset) const {
+		if (head_known) {
+			return get(head + offset);
+		}
+
+		ValueRange result = others;
+		for (const auto &[cell, range] : cells) {
+			result = join(result, range);
+		}
+
+		return result;
+	}
+
+	// stores into the cell at `offset`, or into any cell of the tape. The states are copied at every loop,
+	// so past range_state_cells the cells listed so far are folded into `others`
+	template <typename Update>
+	void update(int offset, const Update &f) {
+		if (head_known) {
+			const ValueRange range = f(get(head + offset));
+
+			if (cells.size() >= range_state_cells and cells.count(head + offset) == 0) {
+				for (const auto &[cell, listed] : cells) {
+					others = join(others, listed);
+				}
+				cells.clear();
+			}
+
+			cells[head + offset] = range;
+			return;
+		}
+
+		for (auto &[cell, range] : cells) {
+			range = join(range, f(range));
+		}
+
+		others = join(others, f(others));
+	}
+
+	bool operator==(const RangeState &other) const {
+		return reached == other.reached and head_known == other.head_known and (not head_known or head == other.head)
+			and cells == other.cells and others == other.others;
+	}
+};
+
+
+// Widening of the loops: a growing upper bound jumps to the next of 1, 15, 255 and the largest value,
+// so the flags and the small counters keep their range and the analysis ends after a few iterations
+ValueRange widen(ValueRange before, ValueRange after, uint64_t cell_max) {
+	if (after.highest > before.highest) {
+		for (uint64_t threshold : {uint64_t(1), uint64_t(15), uint64_t(255), cell_max}) {
+			if (after.highest <= threshold) {
+				after.highest = threshold;
+				break;
+			}
+		}
+	}
+
+	if (after.lowest < before.lowest) {
+		after.lowest = 0;
+	}
+
+	return after;
+}
+
+
+// Joins `incoming` into the state of an instruction, returns whether it changed
+bool merge_state(RangeState &state, const RangeState &incoming, uint64_t cell_max) {
+	if (not incoming.reached) {
+		return false;
+	}
+
+	if (not state.reached) {
+		state = incoming;
+		return true;
+	}
+
+	RangeState merged = state;
+	merged.head_known = state.head_known and incoming.head_known and state.head == incoming.head;
+	merged.others     = widen(state.others, join(state.others, incoming.others), cell_max);
+
+	for (auto &[cell, range] : merged.cells) {
+		range = widen(range, join(range, incoming.get(cell)), cell_max);
+	}
+
+	for (const auto &[cell, range] : incoming.cells) {
+		if (state.cells.count(cell) == 0) {
+			merged.cells[cell] = widen(state.others, join(state.others, range), cell_max);
+		}
+	}
+
+	if (merged == state) {
+		return false;
+	}
+
+	state = std::move(merged);
+	return true;
+}
+
+
+// Range of the values of every cell over the whole execution, by abstract interpretation of the program
+// with its jump table: the cells start at zero, a loop is entered with a nonzero cell and left with a zero one.
+// Cells not in `cells` stay within `others`
+struct ValueRanges {
+	std::map<long, ValueRange> cells;
+	ValueRange others;
+};
+
+
+// The states are kept only at the start of the program, of the loop bodies and after the loops, the code in
+// between is walked in a straight line. Every value a cell takes is stored by an instruction, so the result
+// is the union of the ranges stored by the walks from the final states
+ValueRanges analyze_value_ranges(const Instruction *program, size_t size, int cell_bits) {
+	const uint64_t cell_max = cell_bits == 64 ? ~uint64_t(0) : (uint64_t(1) << cell_bits) - 1;
+
+	// the lowest start first, so that a loop is stable before the code after it is walked
+	std::unordered_map<size_t, RangeState> states;
+	std::set<size_t> work = {0};
+
+	states[0].reached = true;
+
+	auto propagate = [&](size_t target, const RangeState &state) {
+		if (merge_state(states[target], state, cell_max)) {
+			work.insert(target);
+		}
+	};
+
+	ValueRanges result;
+
+	// the cells that `offset` may name, after a store
+	auto stored = [&](const RangeState &state, int offset) {
+		if (state.head_known) {
+			result.cells[state.head + offset] = join(result.cells[state.head + offset], state.get(state.head + offset));
+			return;
+		}
+
+		for (const auto &[cell, range] : state.cells) {
+			result.cells[cell] = join(result.cells[cell], range);
+		}
+
+		result.others = join(result.others, state.others);
+	};
+
+	while (not work.empty()) {
+		size_t pc = *work.begin();
+		work.erase(work.begin());
+
+		RangeState state = states[pc];
+
+		for (; pc < size; ++pc) {
+			const Instruction I = program[pc];
+			const uint64_t operand = uint64_t(int64_t(I.operand)) & cell_max;
+
+			switch (I.opcode) {
+				case '+': state.update(I.offset, [&](ValueRange r) { return add_range(r, operand, cell_max); });				break;
+				case '-': state.update(I.offset, [&](ValueRange r) { return add_range(r, (cell_max - operand + 1) & cell_max, cell_max); });	break;
+				case '>': state.head += I.operand;											break;
+				case '<': state.head -= I.operand;											break;
+				case ',': state.update(I.offset, [&](ValueRange) { return ValueRange{0, cell_max}; });					break;
+				case 'z': state.update(I.offset, [&](ValueRange) { return ValueRange{}; });						break;
+
+				case '*': {
+					const ValueRange source = state.any(I.source);
+					uint64_t highest;
+
+					const bool fits = not __builtin_mul_overflow(source.highest, operand, &highest) and highest <= cell_max;
+					const uint64_t lowest = fits ? source.lowest * operand : 0;
+
+					state.update(I.offset, [&](ValueRange r) {
+						return fits and r.highest <= cell_max - highest ? ValueRange{r.lowest + lowest, r.highest + highest} : ValueRange{0, cell_max};
+					});
+					break;
+				}
+			}
+
+			if (I.opcode != '<' and I.opcode != '>' and I.opcode != '.' and I.opcode != '[' and I.opcode != ']') {
+				stored(state, I.offset);
+			}
+
+			// the body starts after the '[' with a nonzero cell, the loop ends after the ']' with a zero one
+			if (I.opcode == '[' or I.opcode == ']') {
+				const size_t body = I.opcode == '[' ? pc + 1 : I.operand + 1;
+				const size_t exit = I.opcode == '[' ? I.operand + 1 : pc + 1;
+				const ValueRange cell = state.any(0);
+
+				if (cell.highest > 0) {
+					RangeState entered = state;
+					if (entered.head_known) {
+						entered.cells[entered.head] = {std::max<uint64_t>(cell.lowest, 1), cell.highest};
+					}
+					propagate(body, entered);
+				}
+
+				if (cell.lowest == 0) {
+					RangeState left = state;
+					if (left.head_known) {
+						left.cells[left.head] = {};
+					}
+					propagate(exit, left);
+				}
+
+				break;
+			}
+		}
+	}
+
+	// a cell that some states don't list is within their `others` there
+	for (auto &[cell, range] : result.cells) {
+		range = join(range, result.others);
+	}
+
+	return result;
+}
+
+
+// Instrumentation of the interpreter for --value-ranges: the largest value stored in every cell.
+// The cells start at zero, so that's the whole range
+class ValueProfile {
+public:
+	void step(long) {}
+	void read(long) {}
+	void write(long) {}
+	void modify(long) {}
+
+	template <typename Cells>
+	void written(Cells &memory, long cell) {
+		const uint64_t value = uint64_t(memory[cell]);
+		uint64_t &highest = highest_values[cell];
+		highest = std::max(highest, value);
+	}
+
+	ValueRanges ranges() const {
+		ValueRanges result;
+
+		for (size_t i = 0; i < highest_values.values.size(); ++i) {
+			if (highest_values.values[i] > 0) {
+				result.cells[highest_values.first + long(i)] = {0, highest_values.values[i]};
+			}
+		}
+
+		return result;
+	}
+
+private:
+	CellArray<uint64_t> highest_values;
+};
+
+
+// Bits needed by the values of a cell: 0 for the cells that stay zero, 1 for flags, 4 for small counters,
+// and the widths of the cells
+int value_bits(uint64_t highest) {
+	for (int bits : {0, 1, 4, 8, 16, 32}) {
+		if (highest < (uint64_t(1) << bits)) {
+			return bits;
+		}
+	}
+
+	return 64;
+}
+
+
+std::string bits_name(int bits) {
+	return bits == 0 ? "always zero" : std::to_string(bits) + " bit";
+}
+
+
+// Regions of consecutive cells that need the same bits and, if the cells between the extreme ones repeat
+// with a period, the bits of each cell of the record: a vectorized interpreter can pack the cells narrower than
+// the tape, 32 flags or 8 small counters to a 32 bit word
+void print_value_ranges(std::ostream &out, const char *title, const ValueRanges &ranges, int cell_bits) {
+	const long lowest  = ranges.cells.empty() ? 0 : ranges.cells.begin()->first;
+	const long highest = ranges.cells.empty() ? 0 : ranges.cells.rbegin()->first;
+
+	std::vector<int> bits;
+	for (long cell = lowest; cell <= highest; ++cell) {
+		const auto it = ranges.cells.find(cell);
+		bits.push_back(value_bits(it != ranges.cells.end() ? it->second.highest : ranges.others.highest));
+	}
+
+	out << "value ranges (" << title << ") of the " << cell_bits << " bit cells from " << lowest << " to " << highest << '\n';
+
+	const size_t region_limit = 16;
+	size_t regions = 0;
+	std::map<int, std::pair<size_t, size_t>> packable;	// bits, cells and regions
+
+	for (size_t begin = 0, end; begin < bits.size(); begin = end) {
+		for (end = begin + 1; end < bits.size() and bits[end] == bits[begin]; ++end);
+
+		if (regions++ < region_limit) {
+			char line[128];
+			snprintf(line, sizeof(line), "  cells %ld to %ld", lowest + long(begin), lowest + long(end) - 1);
+			out << line << std::string(std::max<size_t>(2, 28 - strlen(line)), ' ');
+			out << bits_name(bits[begin]) << '\n';
+		}
+
+		if (bits[begin] < cell_bits) {
+			packable[bits[begin]].first  += end - begin;
+			packable[bits[begin]].second += 1;
+		}
+	}
+
+	if (regions > region_limit) {
+		out << "  and " << regions - region_limit << " more regions" << '\n';
+	}
+
+	out << "  every other cell          " << bits_name(value_bits(ranges.others.highest)) << '\n';
+
+	// the shortest period with which at least 90% of the cells need the bits of the cell one period before
+	for (size_t period = 2; period <= 16 and period * 4 <= bits.size(); ++period) {
+		size_t matching = 0;
+
+		for (size_t i = period; i < bits.size(); ++i) {
+			matching += bits[i] == bits[i - period];
+		}
+
+		std::vector<int> record(period);
+
+		for (size_t i = 0; i < bits.size(); ++i) {
+			record[i % period] = std::max(record[i % period], bits[i]);
+		}
+
+		if (matching * 10 >= (bits.size() - period) * 9 and *std::min_element(record.begin(), record.end()) < *std::max_element(record.begin(), record.end())) {
+			out << "  record of " << period << " cells from " << lowest << "   ";
+			for (int width : record) {
+				out << " " << width;
+			}
+			out << " bit" << '\n';
+			break;
+		}
+	}
+
+	out << "packable                   ";
+	if (packable.empty()) {
+		out << " none";
+	}
+
+	for (const auto &[width, count] : packable) {
+		out << " " << count.first << " cells " << (width == 0 ? "" : "of ") << bits_name(width) << " in " << count.second << " regions,";
+	}
+
+	out << (packable.empty() ? "" : " the others need the whole cell") << std::endl;
+}
+
+
+// Where an execution resumes, and then where it ended: the next instruction and the head.
+// With `until_input` it stops before its first ',' instead, the program ended if none was left
+struct ExecutionPoint {
+	size_t pc   = 0;
+	long   head = 0;
+	bool until_input = false;
+};
+
+
+// `memory` is indexed by cell, relative to the starting one. Cells wrap around at their width, input and
+// output only use the lowest byte. With `track` returns the range of cells that may have been touched: the one
+// between the extreme positions of the head, widened by the offsets of the program. It costs a few percent,
+// so otherwise the whole reach of the dense tape is returned. `profile` is a NoProfile, a TapeProfile or a ValueProfile.
+// With a `point` the execution starts from there, see ExecutionPoint
+template <typename Cell, bool track, typename Cells, typename Profile>
+TapeUsage execute(std::istream &in, std::ostream &out, const Instruction *program, size_t size, Cells &memory, Profile &profile, ExecutionPoint *point = nullptr) {
+	size_t pc   = point != nullptr ? point->pc   : 0;
+	long   head = point != nullptr ? point->head : 0;
+
+	TapeUsage touched;
+	int lowest_offset  = 0;
+	int highest_offset = 0;
+
+	if (track) {
+		for (size_t i = 0; i < size; ++i) {
+			lowest_offset  = std::min({lowest_offset,  program[i].offset, program[i].source});
+			highest_offset = std::max({highest_offset, program[i].offset, program[i].source});
+		}
+	}
+	else {
+		lowest_offset  = -long(tape_reach);
+		highest_offset =  long(tape_reach) - 1;
+	}
+
+	while (pc < size) {
+		const Instruction I = program[pc];
+		executing = program + pc;
+		profile.step(head);
+
+		switch (I.opcode) {
+			case '+': case '-': profile.modify(head + I.offset);					break;
+			case ',': case 'z': profile.write(head + I.offset);					break;
+			case '.':           profile.read(head + I.offset);					break;
+			case '[': case ']': profile.read(head);						break;
+			case '*':           profile.read(head + I.source); profile.modify(head + I.offset);	break;
+		}
+
+		switch (I.opcode) {
+			case '+': memory[head + I.offset] += I.operand;					break;
+			case '-': memory[head + I.offset] -= I.operand;					break;
+			case '<': head -= I.operand; if (track) touched.lowest  = std::min(touched.lowest,  head);	break;
+			case '>': head += I.operand; if (track) touched.highest = std::max(touched.highest, head);	break;
+			// EOF is stored as 0, as every backend does
+			case ',': {
+				if (point != nullptr and point->until_input) {
+					*point = {pc, head, false};
+					pc = size;
+					continue;
+				}
+
+				const int c = in.get();
+				memory[head + I.offset] = c == EOF ? 0 : c;
+				break;
+			}
+
+			case '.': out.put(memory[head + I.offset]);					break;
+			case '[': pc = memory[head] == 0 ? I.operand : pc;				break;
+			case ']': pc = memory[head] == 0 ? pc : I.operand;				break;
+			case 'z': memory[head + I.offset] = 0;						break;
+			case '*': memory[head + I.offset] += Cell(uint64_t(memory[head + I.source]) * uint64_t(I.operand));	break;
+		}
+
+		switch (I.opcode) {
+			case '+': case '-': case ',': case 'z': case '*': profile.written(memory, head + I.offset);	break;
+		}
+
+		++pc;
+	}
+
+	if (point != nullptr and point->until_input) {
+		*point = {size, head, false};
+	}
+
+	touched.lowest  += lowest_offset;
+	touched.highest += highest_offset;
+	return touched;
+}
+
+
+// Options of the executions that don't change the optimized program, the backends use the cell width and the ring
+struct RunOptions {
+	TapeKind tape  = TapeKind::Dense;
+	int cell_bits  = 8;
+	size_t ring    = 0;	// cells of the ring tape, a power of two
+	bool batch     = false;
+	HugePages huge_pages = HugePages::Off;	// of the dense tape and of large programs
+	bool bench     = false;	// compares the huge page policies instead of running once, see benchmark
+	TapeProfile *profile = nullptr;	// records the accesses of the interpreter
+	ValueProfile *values = nullptr;	// records the values of the cells, for --value-ranges
+	bool snapshot  = false;	// the runs of a batch share the setup, see run_snapshot
+};
+
+
+// Copy of a program on huge pages, for the ones large enough that the interpreter takes TLB misses
+// on the instructions too. Smaller programs, or without a policy, are used in place
+class ProgramPages {
+public:
+	ProgramPages(const Instruction *program, size_t size, HugePages policy) : instructions(program) {
+		const size_t bytes = size * sizeof(Instruction);
+
+		if (policy == HugePages::Off or bytes < huge_page) {
+			return;
+		}
+
+		length = (bytes + huge_page - 1) / huge_page * huge_page;
+		mapping = reserve_aligned(length);
+
+		if (mapping == nullptr) {
+			return;
+		}
+
+		map_pages(mapping, length, policy);
+		memcpy(mapping, program, bytes);
+		instructions = reinterpret_cast<const Instruction *>(mapping);
+	}
+
+	~ProgramPages() {
+		if (mapping != nullptr) {
+			munmap(mapping, length);
+		}
+	}
+
+	ProgramPages(const ProgramPages&) = delete;
+	ProgramPages &operator=(const ProgramPages&) = delete;
+
+	const Instruction *instructions;
+
+private:
+	char  *mapping = nullptr;
+	size_t length  = 0;
+};
+
+
+// Takes a pointer and a size, so that the program can also be executed straight from a mapped .bfo file.
+// Cell is one of uint8_t, uint16_t, uint32_t and uint64_t. The runs of a batch track the touched range,
+// to reset only that part of the tape
+template <typename Cell, typename Profile>
+TapeUsage run(std::istream &in, std::ostream &out, const Instruction *program, size_t size, const RunOptions &options, Profile &profile) {
+	if (options.tape == TapeKind::Sparse) {
+		SparseTape<Cell> tape;
+		execute<Cell, false>(in, out, program, size, tape, profile);
+		return tape.usage();
+	}
+
+	if (options.tape == TapeKind::Ring) {
+		RingTape<Cell> tape(options.ring);
+		execute<Cell, false>(in, out, program, size, tape, profile);
+		return tape.usage();
+	}
+
+	// the guards grow with the cells, moves and offsets are counted in cells
+	std::unique_ptr<GuardedTape> tape = tape_pool.acquire(tape_reach * sizeof(Cell), tape_guard * sizeof(Cell), options.huge_pages);
+	Cell *cells = reinterpret_cast<Cell *>(tape->cells);
+
+	const ProgramPages pages(program, size, options.huge_pages);
+	const Instruction *instructions = pages.instructions;
+
+	const TapeUsage touched = options.batch
+		? execute<Cell, true>(in, out, instructions, size, cells, profile)
+		: execute<Cell, false>(in, out, instructions, size, cells, profile);
+
+	const long lowest  = touched.lowest * long(sizeof(Cell));
+	const long highest = (touched.highest + 1) * long(sizeof(Cell)) - 1;
+
+	TapeUsage usage = tape->usage(lowest, highest);
+	tape_pool.release(std::move(tape), lowest, highest);
+
+	usage.lowest  /= long(sizeof(Cell));
+	usage.highest /= long(sizeof(Cell));
+	return usage;
+}
+
+
+template <typename Cell = uint8_t>
+TapeUsage run(std::istream &in, std::ostream &out, const Instruction *program, size_t size, const RunOptions &options = {}) {
+	if (options.profile != nullptr) {
+		return run<Cell>(in, out, program, size, options, *options.profile);
+	}
+
+	if (options.values != nullptr) {
+		return run<Cell>(in, out, program, size, options, *options.values);
+	}
+
+	NoProfile profile;
+	return run<Cell>(in, out, program, size, options, profile);
+}
+
+
+TapeUsage run(std::istream &in, std::ostream &out, const Instruction *program, size_t size, const RunOptions &options) {
+	switch (options.cell_bits) {
+		case 16: return run<uint16_t>(in, out, program, size, options);
+		case 32: return run<uint32_t>(in, out, program, size, options);
+		case 64: return run<uint64_t>(in, out, program, size, options);
+		default: return run<uint8_t> (in, out, program, size, options);
+	}
+}
+
+
+// Runs of a batch that share a setup: the program runs once on a tape in a memfd until it reads its first input,
+// which is all it can do without one. The tape is then a snapshot, and every line resumes the execution from there
+// on a private mapping of it, so a run costs the pages it writes, not the setup. Forking for every line would
+// share the pages as well, this keeps the runs in one process and their output in order.
+// The output of the setup is written in front of the one of every run
+template <typename Cell>
+TapeUsage run_snapshot(std::istream &lines, std::ostream &out, const Instruction *program, size_t size) {
+	GuardedTape tape(tape_reach * sizeof(Cell), tape_guard * sizeof(Cell));
+	Cell *cells = reinterpret_cast<Cell *>(tape.cells);
+
+	if (not tape.share()) {
+		std::cerr << "Cannot allocate the tape snapshot" << std::endl;
+		exit(1);
+	}
+
+	NoProfile profile;
+	ExecutionPoint setup;
+	setup.until_input = true;
+
+	std::istringstream no_input;
+	std::ostringstream setup_output;
+	execute<Cell, false>(no_input, setup_output, program, size, cells, profile, &setup);
+
+	const std::string prefix = setup_output.str();
+	std::string line;
+
+	while (std::getline(lines, line)) {
+		if (not lines.eof()) {
+			line += '\n';
+		}
+
+		if (not tape.restore()) {
+			std::cerr << "Cannot map the tape snapshot" << std::endl;
+			exit(1);
+		}
+
+		std::istringstream in(line);
+		ExecutionPoint resume = setup;
+
+		out << prefix;
+		execute<Cell, false>(in, out, program, size, cells, profile, &resume);
+	}
+
+	TapeUsage usage = tape.usage(-long(tape.reach), long(tape.reach) - 1);
+	usage.lowest  /= long(sizeof(Cell));
+	usage.highest /= long(sizeof(Cell));
+	return usage;
+}
+
+
+TapeUsage run_snapshot(std::istream &lines, std::ostream &out, const Instruction *program, size_t size, int cell_bits) {
+	switch (cell_bits) {
+		case 16: return run_snapshot<uint16_t>(lines, out, program, size);
+		case 32: return run_snapshot<uint32_t>(lines, out, program, size);
+		case 64: return run_snapshot<uint64_t>(lines, out, program, size);
+		default: return run_snapshot<uint8_t> (lines, out, program, size);
+	}
+}
+
+
+// Runs the program on stdin or, with --batch, once for every line of stdin (newline included), each run starting
+// from a clean tape. The dense tapes come from tape_pool, so their usage covers all the runs so far.
+// The profile and the value ranges, if any, are reported after the last run
+TapeUsage run_stdin(const Instruction *program, size_t size, const RunOptions &options) {
+	TapeUsage usage;
+
+	if (not options.batch) {
+		usage = run(std::cin, std::cout, program, size, options);
+	}
+	else if (options.snapshot) {
+		usage = run_snapshot(std::cin, std::cout, program, size, options.cell_bits);
+	}
+	else {
+		std::string line;
+
+		while (std::getline(std::cin, line)) {
+			if (not std::cin.eof()) {
+				line += '\n';
+			}
+
+			std::istringstream in(line);
+			usage = run(in, std::cout, program, size, options);
+		}
+	}
+
+	if (options.profile != nullptr) {
+		std::cout << std::flush;
+		options.profile->report(std::cerr);
+	}
+
+	if (options.values != nullptr) {
+		std::cout << std::flush;
+		print_value_ranges(std::cerr, "static analysis", analyze_value_ranges(program, size, options.cell_bits), options.cell_bits);
+		print_value_ranges(std::cerr, "observed", options.values->ranges(), options.cell_bits);
+	}
+
+	return usage;
+}
+
+
+// Counter of the calling thread, in user space only, which perf_event_paranoid allows up to level 2.
+// The hardware ones are missing on most virtual machines: the counter stays closed and reads -1
+class PerfCounter {
+public:
+	PerfCounter(uint32_t type, uint64_t config) {
+		perf_event_attr attributes = {};
+		attributes.size           = sizeof(attributes);
+		attributes.type           = type;
+		attributes.config         = config;
+		attributes.disabled       = 1;
+		attributes.exclude_kernel = 1;
+		attributes.exclude_hv     = 1;
+
+		fd = syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+	}
+
+	~PerfCounter() {
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+
+	PerfCounter(const PerfCounter&) = delete;
+	PerfCounter &operator=(const PerfCounter&) = delete;
+
+	void start() {
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	long long stop() {
+		long long count = -1;
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+		if (fd < 0 or read(fd, &count, sizeof(count)) != sizeof(count)) {
+			return -1;
+		}
+
+		return count;
+	}
+
+private:
+	int fd;
+};
+
+
+const uint64_t dtlb_load_misses  = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ  << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+const uint64_t dtlb_store_misses = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_WRITE << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+
+// Runs the program once with every huge page policy, on a fresh tape, on the same input read from stdin and
+// without output, and prints the time and the counters of each run on stderr: the cost of a large tape is in
+// the page faults of the first touches and in the misses of the data TLB
+void benchmark(const Instruction *program, size_t size, RunOptions options) {
+	const std::string input((std::istreambuf_iterator<char>(std::cin)), std::istreambuf_iterator<char>());
+	char line[256];
+
+	snprintf(line, sizeof(line), "%-12s %-12s %10s %12s %18s %18s %16s\n",
+		"huge pages", "backing", "time [ms]", "page faults", "dTLB load misses", "dTLB store misses", "committed [KB]");
+	std::cerr << line;
+
+	auto count = [](long long value) {
+		return value < 0 ? std::string("n/a") : std::to_string(value);
+	};
+
+	for (HugePages policy : {HugePages::Off, HugePages::Transparent, HugePages::Explicit}) {
+		options.huge_pages = policy;
+
+		std::istringstream in(input);
+		std::ostream out(nullptr);
+
+		PerfCounter faults(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+		PerfCounter loads(PERF_TYPE_HW_CACHE, dtlb_load_misses);
+		PerfCounter stores(PERF_TYPE_HW_CACHE, dtlb_store_misses);
+
+		faults.start();
+		loads.start();
+		stores.start();
+		const auto start = std::chrono::steady_clock::now();
+
+		const TapeUsage usage = run(in, out, program, size, options);
+
+		const double milliseconds = milliseconds_since(start);
+		const long long store_misses = stores.stop();
+		const long long load_misses  = loads.stop();
+		const long long page_faults  = faults.stop();
+
+		snprintf(line, sizeof(line), "%-12s %-12s %10.3f %12s %18s %18s %16zu\n",
+			huge_pages_name(policy), huge_pages_name(usage.backing), milliseconds,
+			count(page_faults).c_str(), count(load_misses).c_str(), count(store_misses).c_str(), usage.committed_kb);
+		std::cerr << line;
+	}
+}
+
+
+// The assembly and machine code backends address the cells around the head on the mirrored ring without masking,
+// so two offsets of the same instruction block must never name the same cell: every offset is reduced to
+// the cell it names on the ring, within half a ring of the head
+void wrap_offsets(std::vector<Instruction> &program, size_t ring) {
+	const long half = long(ring / 2);
+
+	auto wrap = [&](int offset) {
+		const long cell = long(offset) & (long(ring) - 1);
+		return int(cell > half ? cell - long(ring) : cell);
+	};
+
+	for (Instruction &I : program) {
+		I.offset = wrap(I.offset);
+		I.source = wrap(I.source);
+	}
+}
+
+
+// Recognizes runs of 'z' on consecutive cells, like the ones produced by [-]>[-]>[-], starting at `begin`.
+// Returns the number of cleared cells and sets `lowest` to the offset of the leftmost one
+size_t match_clear_run(const std::vector<Instruction> &program, size_t begin, int &lowest) {
+	size_t length = 1;
+	int step = 0;
+
+	while (begin + length < program.size() and program[begin + length].opcode == 'z') {
+		const int distance = program[begin + length].offset - program[begin + length - 1].offset;
+
+		if ((distance != 1 and distance != -1) or (step != 0 and distance != step)) {
+			break;
+		}
+
+		step = distance;
+		++length;
+	}
+
+	lowest = std::min(program[begin].offset, program[begin + length - 1].offset);
+	return length;
+}
+
+
+// Upper bound on the number of '.' executed between two consecutive loop tests, the transpiled programs
+// reserve this many bytes past the flush threshold of their output buffer
+int max_outputs_between_branches(const std::vector<Instruction> &program) {
+	int result = 0;
+	int count  = 0;
+
+	for (const Instruction &I : program) {
+		if (I.opcode == '.') {
+			result = std::max(result, ++count);
+		}
+		else if (I.opcode == '[' or I.opcode == ']') {
+			count = 0;
+		}
+	}
+
+	return result;
+}
+
+
+// Output of the text backends. The code is appended to a growable byte buffer, with integers formatted
+// by hand, and reaches the stream with a single write when the emitter is destroyed.
+// Very large outputs are written every flush_threshold bytes, to keep the streaming mode in bounded memory
+class TextEmitter {
+public:
+	explicit TextEmitter(std::ostream &target) : target(target) {}
+	~TextEmitter() { flush(); }
+
+	TextEmitter(const TextEmitter&) = delete;
+	TextEmitter &operator=(const TextEmitter&) = delete;
+
+	TextEmitter &operator<<(const char *text)        { return append(text, strlen(text)); }
+	TextEmitter &operator<<(const std::string &text) { return append(text.data(), text.size()); }
+
+	TextEmitter &operator<<(char c) {
+		reserve(1);
+		buffer[size++] = c;
+		return *this;
+	}
+
+	template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+	TextEmitter &operator<<(T n) {
+		char digits[24];
+		char *begin = digits + sizeof(digits);
+
+		// the magnitude is computed unsigned, so that the lowest value doesn't overflow
+		unsigned long long magnitude = n < 0 ? 0ull - static_cast<unsigned long long>(n) : static_cast<unsigned long long>(n);
+
+		do {
+			*--begin = '0' + magnitude % 10;
+			magnitude /= 10;
+		} while (magnitude > 0);
+
+		if (n < 0) {
+			*--begin = '-';
+		}
+
+		return append(begin, digits + sizeof(digits) - begin);
+	}
+
+	void flush() {
+		target.write(buffer.data(), size);
+		target.flush();
+		size = 0;
+	}
+
+private:
+	static const size_t flush_threshold = 1 << 24;
+
+	std::ostream &target;
+	std::vector<char> buffer = std::vector<char>(1 << 16);
+	size_t size = 0;
+
+	void reserve(size_t n) {
+		if (size + n > buffer.size()) {
+			buffer.resize(std::max(2 * buffer.size(), size + n));
+		}
+	}
+
+	TextEmitter &append(const char *text, size_t n) {
+		reserve(n);
+		memcpy(buffer.data() + size, text, n);
+		size += n;
+
+		if (size >= flush_threshold) {
+			flush();
+		}
+
+		return *this;
+	}
+};
+
+
+// Buffered replacement of putchar/getchar for the transpiled programs.
+// Writing a cell is just `*output_end++ = value`: the buffer is checked only at the end of the straight
+// line segments that produced output, and the slack past the threshold guarantees that no segment overflows it.
+// The output is also flushed before blocking on a read, so interactive programs keep working.
+// The buffer itself is defined by emit_c_output_buffer at the end of the file, when the slack is known
+void emit_c_stdio(TextEmitter &out) {
+	const int threshold = 1 << 16;
+
+	out
+		<< "#include <unistd.h>\n\n"
+		<< "#define OUTPUT_THRESHOLD " << threshold << "\n\n"
+		<< "extern unsigned char output[];\n"
+		<< "static unsigned char *output_end = output;\n\n"
+		<< "static unsigned char input[1 << 16];\n"
+		<< "static unsigned char *input_begin = input;\n"
+		<< "static unsigned char *input_end   = input;\n\n"
+		<< "static void flush_output(void) {\n"
+		<< "\tunsigned char *p = output;\n\n"
+		<< "\twhile (p < output_end) {\n"
+		<< "\t\tssize_t n = write(1, p, output_end - p);\n"
+		<< "\t\tif (n <= 0) break;\n"
+		<< "\t\tp += n;\n"
+		<< "\t}\n\n"
+		<< "\toutput_end = output;\n"
+		<< "}\n\n"
+		<< "static inline unsigned char read_input(void) {\n"
+		<< "\tif (input_begin == input_end) {\n"
+		<< "\t\tssize_t n;\n\n"
+		<< "\t\tflush_output();\n"
+		<< "\t\tn = read(0, input, sizeof(input));\n"
+		<< "\t\tif (n <= 0) return 0;\n\n"
+		<< "\t\tinput_begin = input;\n"
+		<< "\t\tinput_end   = input + n;\n"
+		<< "\t}\n\n"
+		<< "\treturn *input_begin++;\n"
+		<< "}\n\n";
+}
+
+
+const char *c_output_check = "if (output_end >= output + OUTPUT_THRESHOLD) flush_output();";
+
+
+void emit_c_output_buffer(TextEmitter &out, int slack) {
+	out << "\nunsigned char output[OUTPUT_THRESHOLD + " << slack << "];\n";
+}
+
+
+// Same guarded and lazily committed tape as the interpreter, see GuardedTape: the transpiled programs
+// don't know the source positions, so the fault handler only reports the overflow.
+// Compiled with -DTAPE_HUGE_PAGES they ask for transparent huge pages, as runtime.c
+void emit_c_tape(TextEmitter &out, int cell_bits) {
+	out
+		<< "#include <signal.h>\n"
+		<< "#include <stdint.h>\n"
+		<< "#include <sys/mman.h>\n\n"
+		<< "#define TAPE_GUARD ((size_t) " << cell_bits / 8 << " << 32)\n\n"
+		<< "static char *tape_begin;\n"
+		<< "static char *tape_end;\n\n"
+		<< "static void tape_fault(int number, siginfo_t *info, void *context) {\n"
+		<< "\tconst char *address = info->si_addr;\n"
+		<< "\tstatic const char message[] = \"Tape overflow\\n\";\n\n"
+		<< "\t(void) context;\n"
+		<< "\tif ((address >= tape_begin - TAPE_GUARD && address < tape_begin) || (address >= tape_end && address < tape_end + TAPE_GUARD)) {\n"
+		<< "\t\tif (write(2, message, sizeof(message) - 1) < 0) _exit(1);\n"
+		<< "\t\t_exit(1);\n"
+		<< "\t}\n\n"
+		<< "\tsignal(number, SIG_DFL);\n"
+		<< "}\n\n"
+		<< "static void *allocate_tape(size_t reach) {\n"
+		<< "\tconst size_t page = sysconf(_SC_PAGESIZE);\n"
+		<< "\tstruct sigaction action = {0};\n"
+		<< "\tchar *base;\n\n"
+		<< "\treach = (reach + page - 1) / page * page;\n"
+		<< "\tbase = mmap(NULL, 2 * reach + 2 * TAPE_GUARD, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);\n\n"
+		<< "\tif (base == MAP_FAILED || mprotect(base + TAPE_GUARD, 2 * reach, PROT_READ | PROT_WRITE) != 0) {\n"
+		<< "\t\tstatic const char message[] = \"Cannot allocate the tape\\n\";\n"
+		<< "\t\tif (write(2, message, sizeof(message) - 1) < 0) _exit(1);\n"
+		<< "\t\t_exit(1);\n"
+		<< "\t}\n\n"
+		<< "\ttape_begin = base + TAPE_GUARD;\n"
+		<< "\ttape_end   = tape_begin + 2 * reach;\n\n"
+		<< "#ifdef TAPE_HUGE_PAGES\n"
+		<< "\tmadvise(tape_begin, 2 * reach, MADV_HUGEPAGE);\n"
+		<< "#endif\n\n"
+		<< "\taction.sa_sigaction = tape_fault;\n"
+		<< "\taction.sa_flags     = SA_SIGINFO;\n"
+		<< "\tsigaction(SIGSEGV, &action, NULL);\n\n"
+		<< "\treturn tape_begin + reach;\n"
+		<< "}\n\n";
+}
+
+
+// Ring tape of the transpiled programs: the C compilers reason about the addresses, so the cells live in a single
+// copy and the index of every access is masked, as the interpreter does with RingTape
+void emit_c_ring(TextEmitter &out) {
+	out
+		<< "#include <stdint.h>\n"
+		<< "#include <stdlib.h>\n\n"
+		<< "static void *allocate_ring(size_t cells, size_t size) {\n"
+		<< "\tvoid *ring = calloc(cells, size);\n\n"
+		<< "\tif (ring == NULL) {\n"
+		<< "\t\tstatic const char message[] = \"Cannot allocate the ring tape\\n\";\n"
+		<< "\t\tif (write(2, message, sizeof(message) - 1) < 0) _exit(1);\n"
+		<< "\t\t_exit(1);\n"
+		<< "\t}\n\n"
+		<< "\treturn ring;\n"
+		<< "}\n\n";
+}
+
+
+// C type of the cells, 8 bit cells keep the type of each backend
+const char *c_cell_type(int cell_bits, const char *byte) {
+	switch (cell_bits) {
+		case 16: return "uint16_t";
+		case 32: return "uint32_t";
+		case 64: return "uint64_t";
+		default: return byte;
+	}
+}
+
+
+// 16 bit cells are promoted to int, their products must be computed unsigned not to overflow
+const char *c_product_cast(int cell_bits) {
+	return cell_bits == 16 ? "(unsigned) " : "";
+}
+
+
+// Optimized flavour of transpile_to_c: the head is an `unsigned char *restrict` addressed with the offsets
+// computed by the optimizer, and runs of cleared cells become memset. Everything is placed in a
+// static inline function, called once on the guarded tape, or on the ring tape when `ring` isn't 0
+void transpile_to_optimized_c(TextEmitter &out, const std::vector<Instruction> &program, int cell_bits, size_t reach, size_t ring) {
+	// the operands of 8 bit cells are reduced, wider cells wrap around on their own
+	const int mask = cell_bits == 8 ? 0xff : -1;
+
+	int depth = 1;
+
+	auto indent = [&]() -> TextEmitter& {
+		return out << std::string(depth, '\t');
+	};
+
+	bool pending_output = false;
+
+	auto check_output = [&]() {
+		if (pending_output) {
+			indent() << c_output_check << '\n';
+			pending_output = false;
+		}
+	};
+
+	out << "#include <string.h>\n";
+	emit_c_stdio(out);
+
+	if (ring != 0) {
+		emit_c_ring(out);
+	}
+	else {
+		emit_c_tape(out, cell_bits);
+	}
+
+	out << "static inline void run(" << c_cell_type(cell_bits, "unsigned char") << " *restrict p) {\n";
+
+	// on the ring tape p stays at the start of the ring and the head is the index h
+	const std::string wrap = " & " + std::to_string(ring - 1);
+
+	auto cell = [&](int offset) {
+		if (ring == 0) {
+			return "p[" + std::to_string(offset) + "]";
+		}
+
+		return offset == 0 ? std::string("p[h]") : "p[(h + " + std::to_string(offset) + ")" + wrap + "]";
+	};
+
+	auto move = [&](char sign, int n) {
+		if (ring != 0) {
+			indent() << "h = (h " << sign << ' ' << n << ")" << wrap << ";\n";
+		}
+		else {
+			indent() << "p " << sign << "= " << n << ";\n";
+		}
+	};
+
+	if (ring != 0) {
+		indent() << "size_t h = 0;\n";
+	}
+
+	for (size_t i = 0; i < program.size(); ++i) {
+		const Instruction I = program[i];
+
+		switch (I.opcode) {
+			case '+': indent() << cell(I.offset) << " += " << (I.operand & mask) << ";\n";	break;
+			case '-': indent() << cell(I.offset) << " -= " << (I.operand & mask) << ";\n";	break;
+			case '<': move('-', I.operand);							break;
+			case '>': move('+', I.operand);							break;
+			case ',': indent() << cell(I.offset) << " = read_input();\n";				break;
+
+			case '.':
+				indent() << "*output_end++ = " << cell(I.offset) << ";\n";
+				pending_output = true;
+				break;
+
+			case '[':
+				check_output();
+				indent() << "while (" << (ring != 0 ? "p[h]" : "*p") << ") {\n";
+				++depth;
+				break;
+
+			case ']':
+				check_output();
+				--depth;
+				indent() << "}\n";
+				break;
+
+			case 'z': {
+				// a run of cleared cells may wrap around the ring
+				int lowest;
+				const size_t length = ring != 0 ? 1 : match_clear_run(program, i, lowest);
+
+				if (length == 1) {
+					indent() << cell(I.offset) << " = 0;\n";
+				}
+				else {
+					indent() << "memset(p + " << lowest << ", 0, " << length * (cell_bits / 8) << ");\n";
+				}
+
+				i += length - 1;
+				break;
+			}
+
+			case '*':
+				indent() << cell(I.offset) << " += " << c_product_cast(cell_bits) << cell(I.source) << " * " << (I.operand & mask) << ";\n";
+				break;
+
+			default: assert(0);
+		}
+	}
+
+	out
+		<< "}\n\n"
+		<< "int main() {\n";
+
+	if (ring != 0) {
+		out << "\trun(allocate_ring(" << ring << ", " << cell_bits / 8 << "));\n";
+	}
+	else {
+		out << "\trun(allocate_tape(" << reach * (cell_bits / 8) << "));\n";
+	}
+
+	out
+		<< "\tflush_output();\n"
+		<< "\treturn 0;\n"
+		<< "}\n";
+
+	emit_c_output_buffer(out, max_outputs_between_branches(program));
+}
+
+
+// memory[head + offset] as C source, the index is masked on a ring of `ring` cells
+std::string c_cell(int offset, size_t ring = 0) {
+	if (offset == 0) {
+		return "memory[head]";
+	}
+
+	if (ring != 0) {
+		return "memory[(head + " + std::to_string(offset) + ") & " + std::to_string(ring - 1) + "]";
+	}
+
+	return "memory[head + " + std::to_string(offset) + "]";
+}
+
+
+// The plain translation looks at one instruction at a time, so it also accepts a StreamingProgram.
+// On the ring tape the head is wrapped around by every move
+template <typename Program>
+void transpile_to_plain_c(TextEmitter &out, Program &&program, int cell_bits = 8, size_t reach = tape_reach, size_t ring = 0) {
+	emit_c_stdio(out);
+
+	if (ring != 0) {
+		emit_c_ring(out);
+	}
+	else {
+		emit_c_tape(out, cell_bits);
+	}
+
+	out
+		<< c_cell_type(cell_bits, "char") << " *memory;\n\n"
+		<< "int main() {\n"
+		<< "int head = 0;\n";
+
+	if (ring != 0) {
+		out << "memory = allocate_ring(" << ring << ", " << cell_bits / 8 << ");\n";
+	}
+	else {
+		out << "memory = allocate_tape(" << reach * (cell_bits / 8) << ");\n";
+	}
+
+	auto move = [&](char sign, int n) -> TextEmitter& {
+		if (ring != 0) {
+			return out << "head = (head " << sign << ' ' << n << ") & " << ring - 1 << ";";
+		}
+
+		return out << "head " << sign << "= " << n << ";";
+	};
+
+	// '.' since the last loop test, and the most of them ever found
+	int outputs     = 0;
+	int max_outputs = 0;
+
+	for (const Instruction &I : program) {
+		if ((I.opcode == '[' or I.opcode == ']') and outputs > 0) {
+			out << c_output_check << '\n';
+			outputs = 0;
+		}
+
+		switch (I.opcode) {
+			case '+': out << c_cell(I.offset, ring) << " += "	<< I.operand << ";"	; break;
+			case '-': out << c_cell(I.offset, ring) << " -= "	<< I.operand << ";"	; break;
+			case '<': move('-', I.operand)							; break;
+			case '>': move('+', I.operand)							; break;
+			case ',': out << c_cell(I.offset, ring) << " = read_input();"			; break;
+			case '.': out << "*output_end++ = " << c_cell(I.offset, ring) << ";"		; max_outputs = std::max(max_outputs, ++outputs); break;
+			case '[': out << "while (memory[head] != 0) {"					; break;
+			case ']': out << "}"								; break;
+			case 'z': out << c_cell(I.offset, ring) << " = 0;"				; break;
+			case '*': out << c_cell(I.offset, ring) << " += " << c_product_cast(cell_bits) << c_cell(I.source, ring) << " * " << I.operand << ";"; break;
+			default: assert(0);
+		}
+
+		out << '\n';
+	}
+
+	out
+		<< "flush_output();\n"
+		<< "}\n";
+
+	emit_c_output_buffer(out, max_outputs);
+}
+
+
+void transpile_to_c(TextEmitter &out, const std::vector<Instruction> &program, bool optimize = false, int cell_bits = 8, size_t reach = tape_reach, size_t ring = 0) {
+	if (optimize) {
+		transpile_to_optimized_c(out, program, cell_bits, reach, ring);
+	}
+	else {
+		transpile_to_plain_c(out, program, cell_bits, reach, ring);
+	}
+}
+
+
+// Only needs a stack of the open loops for the labels, so it also accepts a StreamingProgram
+template <typename Program>
+void compile_to_x86_asm(TextEmitter &out, Program &&program, size_t ring = 0) {
+	// void run(char *memory) => the memory pointer is in the register rdi
+	//
+	// for readability reasons the registers are harcoded in the generation instructions
+	// 	head_reg <-> %rax
+	// 	 val_reg <-> %rbx
+	// 	ring_reg <-> %r12, the middle copy of the mirrored ring tape of runtime.c, then the head is an index into it
+	// 	         that only wraps around when it moves
+
+	const std::string head_reg("%rax");
+	const std::string  val_reg("%rbx");
+
+	// offset(%rax), or offset(%r12,%rax) on the ring tape
+	auto cell = [&](int offset) {
+		return (offset == 0 ? "" : std::to_string(offset)) + (ring != 0 ? "(%r12,%rax)" : "(%rax)");
+	};
+
+	out
+		<< "\t.data\n"
+		<< "\t.globl run\n"
+		<< "\t.text\n"
+		<< "run:\n"
+		<< "mov  %rdi, %rax\n";
+
+	// the stack stays aligned as without the push for the calls to putchar
+	if (ring != 0) {
+		out
+			<< "push %r12\n"
+			<< "sub  $8, %rsp\n"
+			<< "mov  %rdi, %r12\n"
+			<< "xor  %eax, %eax\n";
+	}
+
+	auto move = [&](const char *op, int n) {
+		out << op << "  $" << n << ", %rax\n";
+
+		if (ring != 0) {
+			out << "and  $" << ring - 1 << ", %rax\n";
+		}
+	};
+
+	// a loop starting at index i is made of the labels .Li (test) and .Ei (exit)
+	std::vector<size_t> open_loops;
+	size_t i = 0;
+
+	for (const Instruction &I : program) {
+
+		switch (I.opcode) {
+			// byte operations, so that the carry doesn't spill into the next cell
+			case '+':
+				out << "addb $" << (I.operand & 0xff) << ", " << cell(I.offset) << '\n';
+				break;
+
+			case '-':
+				out << "subb $" << (I.operand & 0xff) << ", " << cell(I.offset) << '\n';
+				break;
+
+			case '<':
+				move("sub", I.operand);
+				break;
+
+			case '>':
+				move("add", I.operand);
+				break;
+
+			case ',':
+				// EOF is stored as 0, like the interpreter does
+				out << "push %rax\n";
+				out << "call getchar\n";
+				out << "mov  %eax, %ecx\n";
+				out << "pop  %rax\n";
+				out << "xor  %edx, %edx\n";
+				out << "cmp  $-1, %ecx\n";
+				out << "cmove %edx, %ecx\n";
+				out << "movb %cl, " << cell(I.offset) << '\n';
+				break;
+
+			case '.':
+				out << "push %rax\n";
+				out << "mov  " << cell(I.offset) << ", %rdi\n";
+				out << "call putchar\n";
+				out << "pop  %rax\n";
+				break;
+
+			case '[':
+				out << ".L" << i << ":\n";
+				out << "mov  " << cell(0) << ", %rbx\n";
+
+				// branching logic, uses only the lowest bits of rbx
+				out << "cmp  $0, %bl\n";
+				out << "jz   .E" << i << '\n';
+				open_loops.push_back(i);
+				break;
+
+			case ']':
+				out << "jmp  .L" << open_loops.back() << '\n';
+				out << ".E" << open_loops.back() << ":\n";
+				open_loops.pop_back();
+				break;
+
+			case 'z':
+				out << "movb $0, " << cell(I.offset) << '\n';
+				break;
+
+			case '*':
+				out << "movzbl " << cell(I.source) << ", %ebx\n";
+				out << "imul $" << (I.operand & 0xff) << ", %ebx, %ebx\n";
+				out << "addb %bl, " << cell(I.offset) << '\n';
+				break;
+		}
+
+		++i;
+	}
+
+	if (ring != 0) {
+		out
+			<< "add  $8, %rsp\n"
+			<< "pop  %r12\n";
+	}
+
+	out << "ret" << '\n';
+}
+
+
+void compile_to_arm_asm(TextEmitter &out, const std::vector<Instruction> &program, size_t ring = 0) {
+	// void run(char *memory) => the memory pointer is in the register rdi
+	//
+	// for readability reasons the registers are harcoded in the generation instructions
+	// 	head_reg <-> r0
+	// 	 val_reg <-> r1
+	// 	ring_reg <-> r4, the middle copy of the mirrored ring tape of runtime.c, r5 holds its mask
+	const std::string head_reg{"r0"};
+	const std::string  val_reg{"r1"};
+
+
+	// [r0, #offset]
+	auto cell = [](int offset) {
+		return offset == 0 ? std::string("[r0]") : "[r0, #" + std::to_string(offset) + "]";
+	};
+
+	out
+		<< "\t.globl run\n"
+		<< "\t.text\n"
+		<< "run:\n"
+		<< (ring != 0 ? "push  {r4, r5, fp, lr}\n" : "push  {fp, lr}\n");
+
+	// the mask isn't always encodable as an immediate
+	if (ring != 0) {
+		int bits = 0;
+		while ((size_t(1) << bits) < ring) {
+			++bits;
+		}
+
+		out
+			<< "mov  r4, r0\n"
+			<< "mov  r5, #1\n"
+			<< "lsl  r5, r5, #" << bits << '\n'
+			<< "sub  r5, r5, #1\n";
+	}
+
+	auto move = [&](const char *op, int n) {
+		out << op << "  r0, #" << n << '\n';
+
+		if (ring != 0) {
+			out
+				<< "sub  r0, r0, r4\n"
+				<< "and  r0, r0, r5\n"
+				<< "add  r0, r0, r4\n";
+		}
+	};
+
+	for (size_t i = 0; i < program.size(); ++i) {
+		const Instruction I = program[i];
+
+		switch (I.opcode) {
+			case '+':
+				out << "ldr  r1, " << cell(I.offset) << '\n';
+				out << "add  r1, #" << I.operand << '\n';
+				out << "strb r1, " << cell(I.offset) << '\n';
+				break;
+
+			case '-':
+				out << "ldr  r1, " << cell(I.offset) << '\n';
+				out << "sub  r1, #" << I.operand << '\n';
+				out << "strb r1, " << cell(I.offset) << '\n';
+				break;
+
+			case '<':
+				move("sub", I.operand);
+				break;
+
+			case '>':
+				move("add", I.operand);
+				break;
+
+			case ',':
+				// EOF is stored as 0, like the interpreter does
+				out << "push {r0}\n";
+				out << "bl getchar\n";
+				out << "mov  r1, r0\n";
+				out << "pop  {r0}\n";
+				out << "cmn  r1, #1\n";
+				out << "moveq r1, #0\n";
+				out << "strb r1, " << cell(I.offset) << '\n';
+				break;
+
+			case '.':
+				out << "push {r0}\n";
+				out << "ldr  r0, " << cell(I.offset) << '\n';
+				out << "bl putchar\n";
+				out << "pop  {r0}\n";
+				break;
+
+			case '[':
+				// exploit the fact that the label pointers are exactly the indices in the program array
+				out << ".L" << i << ":\n";
+				out << "ldr  r1, [r0]\n";
+
+				out << "and  r1, #255\n";
+				out << "cmp  r1, #0\n";
+				out << "beq  .L" << I.operand << '\n';
+				break;
+
+			case ']':
+				out << "b  .L" << I.operand << '\n';
+				out << ".L" << i << ":\n";
+				break;
+
+			case 'z':
+				out << "mov  r1, #0\n";
+				out << "strb r1, " << cell(I.offset) << '\n';
+				break;
+
+			case '*':
+				out << "ldrb r1, " << cell(I.source) << '\n';
+				out << "ldrb r2, " << cell(I.offset) << '\n';
+				out << "mov  r3, #" << (I.operand & 0xff) << '\n';
+				out << "mla  r2, r1, r3, r2\n";
+				out << "strb r2, " << cell(I.offset) << '\n';
+				break;
+		}
+	}
+
+	out << (ring != 0 ? "pop  {r4, r5, fp, pc}" : "pop  {fp, pc}") << '\n';
+}
+
+
+void aarch64_add_immediate(TextEmitter &out, const char *op, const char *reg, int n) {
+	// add/sub take a 12 bit immediate, optionally shifted by 12
+	if (n < (1 << 12)) {
+		out << op << "  " << reg << ", " << reg << ", #" << n << '\n';
+	}
+	else if (n < (1 << 24)) {
+		out << op << "  " << reg << ", " << reg << ", #" << (n >> 12) << ", lsl #12\n";
+		out << op << "  " << reg << ", " << reg << ", #" << (n & 0xfff) << '\n';
+	}
+	else {
+		out << "movz x9, #" << (n & 0xffff) << '\n';
+		out << "movk x9, #" << (n >> 16) << ", lsl #16\n";
+		out << op << "  " << reg << ", " << reg << ", x9\n";
+	}
+}
+
+
+void compile_to_aarch64_asm(TextEmitter &out, const std::vector<Instruction> &program, size_t ring = 0) {
+	// void run(char *memory) => the memory pointer is in the register x0
+	//
+	// all registers are callee saved, so they survive the calls to putchar/getchar
+	// 	head_reg <-> x19
+	// 	 val_reg <-> w20, always holds the current cell, which is written back only when the head moves
+	// 	ring_reg <-> x21, the middle copy of the mirrored ring tape of runtime.c, saved only when it is used
+	//
+	// additions are not truncated to 8 bits immediately (strb ignores the upper bits),
+	// `dirty` tracks when the value has to be masked before testing it for zero
+	bool dirty = false;
+
+	auto normalize = [&]() {
+		if (dirty) {
+			out << "and  w20, w20, #255\n";
+			dirty = false;
+		}
+	};
+
+	// addressing mode for the cell at `offset`, ldrb/strb accept -256..4095 (the negative ones as ldurb/sturb),
+	// farther cells get their address computed in the `scratch` register
+	auto cell = [&](int offset, const char *scratch) {
+		if (offset >= -256 and offset < 4096) {
+			return "[x19, #" + std::to_string(offset) + "]";
+		}
+
+		out << "mov  " << scratch << ", x19\n";
+		aarch64_add_immediate(out, offset < 0 ? "sub" : "add", scratch, std::abs(offset));
+		return "[" + std::string(scratch) + "]";
+	};
+
+	out
+		<< "\t.globl run\n"
+		<< "\t.text\n"
+		<< "run:\n"
+		<< "stp  x29, x30, [sp, #" << (ring != 0 ? -48 : -32) << "]!\n"
+		<< "mov  x29, sp\n"
+		<< "stp  x19, x20, [sp, #16]\n"
+		<< "mov  x19, x0\n"
+		<< "ldrb w20, [x19]\n";
+
+	if (ring != 0) {
+		out
+			<< "str  x21, [sp, #32]\n"
+			<< "mov  x21, x0\n";
+	}
+
+	for (size_t i = 0; i < program.size(); ++i) {
+		const Instruction I = program[i];
+
+		switch (I.opcode) {
+			case '+':
+			case '-': {
+				const char *op = I.opcode == '+' ? "add" : "sub";
+
+				if (I.offset == 0) {
+					out << op << "  w20, w20, #" << (I.operand & 0xff) << '\n';
+					dirty = true;
+				}
+				else {
+					const std::string address = cell(I.offset, "x10");
+					out << "ldrb w9, " << address << '\n';
+					out << op << "  w9, w9, #" << (I.operand & 0xff) << '\n';
+					out << "strb w9, " << address << '\n';
+				}
+				break;
+			}
+
+			case '<':
+			case '>':
+				// post-indexed store moves the head in the same instruction when the offset fits in 9 bits
+				if (I.operand < 256) {
+					out << "strb w20, [x19], #" << (I.opcode == '<' ? "-" : "") << I.operand << '\n';
+				}
+				else {
+					out << "strb w20, [x19]\n";
+					aarch64_add_immediate(out, I.opcode == '<' ? "sub" : "add", "x19", I.operand);
+				}
+
+				// the mask of the ring is always a valid logical immediate
+				if (ring != 0) {
+					out
+						<< "sub  x10, x19, x21\n"
+						<< "and  x10, x10, #" << ring - 1 << '\n'
+						<< "add  x19, x21, x10\n";
+				}
+
+				out << "ldrb w20, [x19]\n";
+				dirty = false;
+				break;
+
+			case ',':
+				// EOF is stored as 0, like the interpreter does
+				out << "bl   getchar\n";
+				out << "cmn  w0, #1\n";
+
+				if (I.offset == 0) {
+					out << "csel w20, wzr, w0, eq\n";
+					dirty = false;
+				}
+				else {
+					const std::string address = cell(I.offset, "x10");
+					out << "csel w9, wzr, w0, eq\n";
+					out << "strb w9, " << address << '\n';
+				}
+				break;
+
+			case '.':
+				if (I.offset == 0) {
+					out << "mov  w0, w20\n";
+				}
+				else {
+					out << "ldrb w0, " << cell(I.offset, "x10") << '\n';
+				}
+
+				out << "bl   putchar\n";
+				break;
+
+			case '[':
+				// exploit the fact that the label pointers are exactly the indices in the program array
+				normalize();
+				out << "cbz  w20, .L" << I.operand << '\n';
+				out << ".L" << i << ":\n";
+				break;
+
+			case ']':
+				normalize();
+				out << "cbnz w20, .L" << I.operand << '\n';
+				out << ".L" << i << ":\n";
+				break;
+
+			case 'z':
+				if (I.offset == 0) {
+					out << "mov  w20, #0\n";
+					dirty = false;
+				}
+				else {
+					out << "strb wzr, " << cell(I.offset, "x10") << '\n';
+				}
+				break;
+
+			case '*': {
+				// the upper bits of an unmasked w20 only affect the upper bits of the product
+				std::string source = "w20";
+
+				if (I.source != 0) {
+					out << "ldrb w11, " << cell(I.source, "x11") << '\n';
+					source = "w11";
+				}
+
+				out << "mov  w12, #" << (I.operand & 0xff) << '\n';
+
+				if (I.offset == 0) {
+					out << "madd w20, " << source << ", w12, w20\n";
+					dirty = true;
+				}
+				else {
+					const std::string address = cell(I.offset, "x10");
+					out << "ldrb w9, " << address << '\n';
+					out << "madd w9, " << source << ", w12, w9\n";
+					out << "strb w9, " << address << '\n';
+				}
+				break;
+			}
+		}
+	}
+
+	out
+		<< "strb w20, [x19]\n"
+		<< "ldp  x19, x20, [sp, #16]\n";
+
+	if (ring != 0) {
+		out << "ldr  x21, [sp, #32]\n";
+	}
+
+	out
+		<< "ldp  x29, x30, [sp], #" << (ring != 0 ? 48 : 32) << '\n'
+		<< "ret" << '\n';
+}
+
+
+// Emits textual LLVM IR (the typed pointer syntax of LLVM 14) defining `void run(i8* noalias %memory)`,
+// to be linked with runtime.c after going through opt/llc or clang.
+// The head lives in an alloca that mem2reg promotes, multiply-adds are lowered to straight line code
+// and runs of cleared cells to llvm.memset, so that the optimizer starts from the interesting part.
+// On the ring tape the index of every cell but the current one is masked, as the optimizer reasons about the addresses
+void emit_llvm_ir(TextEmitter &out, const std::vector<Instruction> &program, size_t ring = 0) {
+	int temporaries = 0;
+	auto tmp = [&]() { return "%t" + std::to_string(temporaries++); };
+
+	// loads the head and returns the register holding a pointer to the cell at `offset`
+	auto cell = [&](int offset) {
+		const std::string head = tmp();
+		out << "  " << head << " = load i8*, i8** %head\n";
+
+		if (offset == 0) {
+			return head;
+		}
+
+		const std::string p = tmp();
+
+		if (ring != 0) {
+			const std::string a     = tmp();
+			const std::string b     = tmp();
+			const std::string index = tmp();
+			const std::string moved = tmp();
+			const std::string wrap  = tmp();
+			out << "  " << a << " = ptrtoint i8* " << head << " to i64\n";
+			out << "  " << b << " = ptrtoint i8* %memory to i64\n";
+			out << "  " << index << " = sub i64 " << a << ", " << b << '\n';
+			out << "  " << moved << " = add i64 " << index << ", " << offset << '\n';
+			out << "  " << wrap << " = and i64 " << moved << ", " << ring - 1 << '\n';
+			out << "  " << p << " = getelementptr inbounds i8, i8* %memory, i64 " << wrap << '\n';
+			return p;
+		}
+
+		out << "  " << p << " = getelementptr inbounds i8, i8* " << head << ", i64 " << offset << '\n';
+		return p;
+	};
+
+	auto move = [&](int offset) {
+		const std::string p = cell(offset);
+		out << "  store i8* " << p << ", i8** %head\n";
+	};
+
+	out
+		<< "declare i32 @putchar(i32)\n"
+		<< "declare i32 @getchar()\n"
+		<< "declare void @llvm.memset.p0i8.i64(i8* nocapture writeonly, i8, i64, i1 immarg)\n\n"
+		<< "define void @run(i8* noalias nocapture %memory) {\n"
+		<< "entry:\n"
+		<< "  %head = alloca i8*\n"
+		<< "  store i8* %memory, i8** %head\n";
+
+	for (size_t i = 0; i < program.size(); ++i) {
+		const Instruction I = program[i];
+
+		switch (I.opcode) {
+			case '+':
+			case '-': {
+				const std::string p = cell(I.offset);
+				const std::string v = tmp();
+				const std::string w = tmp();
+				out << "  " << v << " = load i8, i8* " << p << '\n';
+				out << "  " << w << " = " << (I.opcode == '+' ? "add" : "sub") << " i8 " << v << ", " << (I.operand & 0xff) << '\n';
+				out << "  store i8 " << w << ", i8* " << p << '\n';
+				break;
+			}
+
+			case '<': move(-I.operand);	break;
+			case '>': move( I.operand);	break;
+
+			case ',': {
+				// EOF is stored as 0, like the interpreter does
+				const std::string c   = tmp();
+				const std::string eof = tmp();
+				const std::string s   = tmp();
+				const std::string v   = tmp();
+				out << "  " << c << " = call i32 @getchar()\n";
+				out << "  " << eof << " = icmp eq i32 " << c << ", -1\n";
+				out << "  " << s << " = select i1 " << eof << ", i32 0, i32 " << c << '\n';
+				out << "  " << v << " = trunc i32 " << s << " to i8\n";
+
+				const std::string p = cell(I.offset);
+				out << "  store i8 " << v << ", i8* " << p << '\n';
+				break;
+			}
+
+			case '.': {
+				const std::string p = cell(I.offset);
+				const std::string v = tmp();
+				const std::string x = tmp();
+				out << "  " << v << " = load i8, i8* " << p << '\n';
+				out << "  " << x << " = zext i8 " << v << " to i32\n";
+				out << "  call i32 @putchar(i32 " << x << ")\n";
+				break;
+			}
+
+			case '[': {
+				// exploit the fact that the label pointers are exactly the indices in the program array
+				out << "  br label %L" << i << "\n";
+				out << "L" << i << ":\n";
+
+				const std::string p = cell(0);
+				const std::string v = tmp();
+				const std::string c = tmp();
+				out << "  " << v << " = load i8, i8* " << p << '\n';
+				out << "  " << c << " = icmp ne i8 " << v << ", 0\n";
+				out << "  br i1 " << c << ", label %B" << i << ", label %E" << i << '\n';
+				out << "B" << i << ":\n";
+				break;
+			}
+
+			case 'z': {
+				// runs of cleared cells become a single memset, unless they may wrap around the ring
+				int lowest;
+				const size_t length = ring != 0 ? 1 : match_clear_run(program, i, lowest);
+
+				if (length == 1) {
+					const std::string p = cell(I.offset);
+					out << "  store i8 0, i8* " << p << '\n';
+				}
+				else {
+					const std::string p = cell(lowest);
+					out << "  call void @llvm.memset.p0i8.i64(i8* " << p << ", i8 0, i64 " << length << ", i1 false)\n";
+				}
+
+				i += length - 1;
+				break;
+			}
+
+			case '*': {
+				const std::string p = cell(I.source);
+				const std::string q = cell(I.offset);
+				const std::string n = tmp();
+				const std::string v = tmp();
+				const std::string m = tmp();
+				const std::string w = tmp();
+				out << "  " << n << " = load i8, i8* " << p << '\n';
+				out << "  " << v << " = load i8, i8* " << q << '\n';
+				out << "  " << m << " = mul i8 " << n << ", " << (I.operand & 0xff) << '\n';
+				out << "  " << w << " = add i8 " << v << ", " << m << '\n';
+				out << "  store i8 " << w << ", i8* " << q << '\n';
+				break;
+			}
+
+			case ']':
+				out << "  br label %L" << I.operand << '\n';
+				out << "E" << I.operand << ":\n";
+				break;
+		}
+	}
+
+	out
+		<< "  ret void\n"
+		<< "}" << '\n';
+}
+
+
+// The x86-64 encoder writes machine code directly, so that the ELF writers below don't need an external assembler.
+// The code follows the same layout of compile_to_x86_asm, but keeps the head in %rbx which survives the calls
+// and accesses memory one byte at a time
+struct X86Encoder {
+	std::vector<uint8_t> code;
+
+	// offsets of the rel32 fields of the calls to putchar/getchar, resolved by the ELF writers
+	std::vector<std::pair<size_t, const char *>> calls;
+
+	size_t here() const { return code.size(); }
+
+	void emit(std::initializer_list<uint8_t> bytes) {
+		code.insert(code.end(), bytes);
+	}
+
+	void emit32(uint32_t x) {
+		for (int k = 0; k < 4; ++k) {
+			code.push_back((x >> (8 * k)) & 0xff);
+		}
+	}
+
+	void patch32(size_t at, uint32_t x) {
+		for (int k = 0; k < 4; ++k) {
+			code[at + k] = (x >> (8 * k)) & 0xff;
+		}
+	}
+
+	void patch64(size_t at, uint64_t x) {
+		patch32(at, x);
+		patch32(at + 4, x >> 32);
+	}
+
+	void call(const char *symbol) {
+		emit({0xe8});
+		calls.push_back({here(), symbol});
+		emit32(0);
+	}
+
+	// on the ring tape rbx is the index of the head in the ring at r12, and the cells are [r12 + rbx + offset]
+	bool indexed = false;
+
+	// instruction with a memory operand addressing the cell at `offset`, `reg` is the register or opcode extension field
+	void memory(std::initializer_list<uint8_t> opcode, uint8_t reg, int offset) {
+		if (indexed) {
+			emit({0x41});		// REX.B, the base is r12
+		}
+
+		emit(opcode);
+		cell(reg, offset);
+	}
+
+	// ModRM (SIB and displacement) of the cell
+	void cell(uint8_t reg, int offset) {
+		const uint8_t mod = offset == 0 ? 0x00 : offset >= -128 and offset < 128 ? 0x40 : 0x80;
+		emit({uint8_t(mod | reg << 3 | (indexed ? 0x04 : 0x03))});
+
+		if (indexed) {
+			emit({0x1c});		// SIB: base r12, index rbx
+		}
+
+		if (mod == 0x40) {
+			emit({uint8_t(offset)});
+		}
+		else if (mod == 0x80) {
+			emit32(offset);
+		}
+	}
+};
+
+
+void encode_x86(X86Encoder &enc, const std::vector<Instruction> &program, size_t ring = 0) {
+	// position of the rel32 field of the forward jump of every '['
+	std::vector<size_t> loop_fixup(program.size());
+
+	// the ring is mapped three times in a row (see runtime.c), the head only wraps around when it moves
+	enc.indexed = ring != 0;
+
+	auto wrap = [&]() {
+		if (ring != 0) {
+			enc.emit({0x48, 0x81, 0xe3});	// and  rbx, imm32
+			enc.emit32(ring - 1);
+		}
+	};
+
+	for (size_t i = 0; i < program.size(); ++i) {
+		const Instruction I = program[i];
+
+		switch (I.opcode) {
+			// add/sub byte [rbx + offset], imm8
+			case '+': enc.memory({0x80}, 0, I.offset); enc.emit({uint8_t(I.operand)});	break;
+			case '-': enc.memory({0x80}, 5, I.offset); enc.emit({uint8_t(I.operand)});	break;
+
+			// add/sub rbx, imm32
+			case '>': enc.emit({0x48, 0x81, 0xc3}); enc.emit32(I.operand); wrap();	break;
+			case '<': enc.emit({0x48, 0x81, 0xeb}); enc.emit32(I.operand); wrap();	break;
+
+			case ',':
+				// EOF is stored as 0, like the interpreter does
+				enc.call("getchar");
+				enc.emit({0x83, 0xf8, 0xff});	// cmp  eax, -1
+				enc.emit({0x75, 0x02});		// jne  +2
+				enc.emit({0x31, 0xc0});		// xor  eax, eax
+				enc.memory({0x88}, 0, I.offset);	// mov  [rbx + offset], al
+				break;
+
+			case '.':
+				enc.memory({0x0f, 0xb6}, 7, I.offset);	// movzx edi, byte [rbx + offset]
+				enc.call("putchar");
+				break;
+
+			case 'z':
+				enc.memory({0xc6}, 0, I.offset);	// mov  byte [rbx + offset], 0
+				enc.emit({0x00});
+				break;
+
+			case '*':
+				enc.memory({0x0f, 0xb6}, 0, I.source);	// movzx eax, byte [rbx + source]
+				enc.emit({0x69, 0xc0});		// imul eax, eax, imm32
+				enc.emit32(I.operand);
+				enc.memory({0x00}, 0, I.offset);	// add  [rbx + offset], al
+				break;
+
+			case '[':
+				enc.memory({0x80}, 7, 0);	// cmp  byte [rbx], 0
+				enc.emit({0x00});
+				enc.emit({0x0f, 0x84});		// je   rel32
+				loop_fixup[i] = enc.here();
+				enc.emit32(0);
+				break;
+
+			case ']': {
+				// the loop test is repeated at the bottom, so that each iteration takes a single branch
+				const size_t body = loop_fixup[I.operand] + 4;
+
+				enc.memory({0x80}, 7, 0);	// cmp  byte [rbx], 0
+				enc.emit({0x00});
+				enc.emit({0x0f, 0x85});		// jne  rel32
+				enc.emit32(body - (enc.here() + 4));
+				enc.patch32(loop_fixup[I.operand], enc.here() - body);
+				break;
+			}
+		}
+	}
+}
+
+
+template <typename T>
+void append_bytes(std::vector<uint8_t> &buffer, const T &value) {
+	const uint8_t *p = reinterpret_cast<const uint8_t *>(&value);
+	buffer.insert(buffer.end(), p, p + sizeof(T));
+}
+
+
+void align_bytes(std::vector<uint8_t> &buffer, size_t alignment) {
+	buffer.resize((buffer.size() + alignment - 1) / alignment * alignment);
+}
+
+
+// Writes a relocatable object that defines `void run(char *memory)`, to be linked with runtime.c
+// just like the output of compile_to_x86_asm
+void compile_to_elf_object(std::ostream &out, const std::vector<Instruction> &program, size_t ring = 0) {
+	X86Encoder enc;
+
+	enc.emit({0x53});			// push rbx (also realigns the stack for the calls)
+	enc.emit({0x48, 0x89, 0xfb});		// mov  rbx, rdi
+
+	if (ring != 0) {
+		enc.emit({0x41, 0x54});		// push r12
+		enc.emit({0x48, 0x83, 0xec, 0x08});	// sub  rsp, 8
+		enc.emit({0x49, 0x89, 0xfc});	// mov  r12, rdi
+		enc.emit({0x31, 0xdb});		// xor  ebx, ebx
+	}
+
+	encode_x86(enc, program, ring);
+
+	if (ring != 0) {
+		enc.emit({0x48, 0x83, 0xc4, 0x08});	// add  rsp, 8
+		enc.emit({0x41, 0x5c});		// pop  r12
+	}
+
+	enc.emit({0x5b});			// pop  rbx
+	enc.emit({0xc3});			// ret
+
+	// symbol table: null, .text section, run, putchar, getchar
+	const std::string strtab("\0run\0putchar\0getchar\0", 21);
+	const std::string shstrtab("\0.text\0.rela.text\0.symtab\0.strtab\0.shstrtab\0.note.GNU-stack\0", 61);
+
+	std::vector<Elf64_Sym> symbols(5);
+	symbols[1].st_info  = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+	symbols[1].st_shndx = 1;
+	symbols[2].st_name  = 1;
+	symbols[2].st_info  = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+	symbols[2].st_shndx = 1;
+	symbols[2].st_size  = enc.code.size();
+	symbols[3].st_name  = 5;
+	symbols[3].st_info  = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+	symbols[4].st_name  = 13;
+	symbols[4].st_info  = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+
+	std::vector<Elf64_Rela> relocations;
+	for (const auto &call : enc.calls) {
+		const uint32_t symbol = strcmp(call.second, "putchar") == 0 ? 3 : 4;
+		relocations.push_back({call.first, ELF64_R_INFO(symbol, R_X86_64_PLT32), -4});
+	}
+
+	std::vector<uint8_t> file(sizeof(Elf64_Ehdr));
+	std::vector<Elf64_Shdr> sections(7);
+
+	auto add_section = [&](size_t index, const void *data, size_t size, size_t alignment) {
+		align_bytes(file, alignment);
+		sections[index].sh_offset    = file.size();
+		sections[index].sh_size      = size;
+		sections[index].sh_addralign = alignment;
+		file.insert(file.end(), static_cast<const uint8_t *>(data), static_cast<const uint8_t *>(data) + size);
+	};
+
+	add_section(1, enc.code.data(), enc.code.size(), 16);
+	sections[1].sh_name  = 1;
+	sections[1].sh_type  = SHT_PROGBITS;
+	sections[1].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+
+	add_section(2, relocations.data(), relocations.size() * sizeof(Elf64_Rela), 8);
+	sections[2].sh_name    = 7;
+	sections[2].sh_type    = SHT_RELA;
+	sections[2].sh_flags   = SHF_INFO_LINK;
+	sections[2].sh_link    = 3;
+	sections[2].sh_info    = 1;
+	sections[2].sh_entsize = sizeof(Elf64_Rela);
+
+	add_section(3, symbols.data(), symbols.size() * sizeof(Elf64_Sym), 8);
+	sections[3].sh_name    = 18;
+	sections[3].sh_type    = SHT_SYMTAB;
+	sections[3].sh_link    = 4;
+	sections[3].sh_info    = 2;
+	sections[3].sh_entsize = sizeof(Elf64_Sym);
+
+	add_section(4, strtab.data(), strtab.size(), 1);
+	sections[4].sh_name = 26;
+	sections[4].sh_type = SHT_STRTAB;
+
+	add_section(5, shstrtab.data(), shstrtab.size(), 1);
+	sections[5].sh_name = 34;
+	sections[5].sh_type = SHT_STRTAB;
+
+	// empty, marks the stack as non executable
+	add_section(6, nullptr, 0, 1);
+	sections[6].sh_name = 44;
+	sections[6].sh_type = SHT_PROGBITS;
+
+	align_bytes(file, 8);
+
+	Elf64_Ehdr header{};
+	memcpy(header.e_ident, ELFMAG, SELFMAG);
+	header.e_ident[EI_CLASS]   = ELFCLASS64;
+	header.e_ident[EI_DATA]    = ELFDATA2LSB;
+	header.e_ident[EI_VERSION] = EV_CURRENT;
+	header.e_type      = ET_REL;
+	header.e_machine   = EM_X86_64;
+	header.e_version   = EV_CURRENT;
+	header.e_shoff     = file.size();
+	header.e_ehsize    = sizeof(Elf64_Ehdr);
+	header.e_shentsize = sizeof(Elf64_Shdr);
+	header.e_shnum     = sections.size();
+	header.e_shstrndx  = 5;
+	memcpy(file.data(), &header, sizeof(header));
+
+	for (const Elf64_Shdr &section : sections) {
+		append_bytes(file, section);
+	}
+
+	out.write(reinterpret_cast<const char *>(file.data()), file.size());
+}
+
+
+// Writes a static executable that doesn't depend on the C library: the memory lives in a zero initialized
+// segment right after the code, that the kernel commits on first touch, with the head starting in its middle.
+// The ring tape is mapped at startup instead, as allocate_ring of runtime.c does.
+// The input/output is done with raw linux syscalls
+void compile_to_elf_executable(std::ostream &out, const std::vector<Instruction> &program, size_t reach = tape_reach, size_t ring = 0) {
+	const uint64_t text_address   = 0x400000;
+	const uint64_t segments       = ring != 0 ? 1 : 2;
+	const uint64_t code_offset    = sizeof(Elf64_Ehdr) + segments * sizeof(Elf64_Phdr);
+
+	X86Encoder enc;
+
+	// positions of the rel32 fields of the jumps taken when a syscall fails, and of the name of the memfd
+	std::vector<size_t> failures;
+	size_t name_fixup = 0;
+
+	// position of the imm64 field with the address of the starting cell, known once the code is complete
+	size_t head_fixup = 0;
+
+	auto checked_syscall = [&]() {
+		enc.emit({0x0f, 0x05});		// syscall
+		enc.emit({0x48, 0x85, 0xc0});	// test rax, rax
+		enc.emit({0x0f, 0x88});		// js   rel32
+		failures.push_back(enc.here());
+		enc.emit32(0);
+	};
+
+	if (ring != 0) {
+		// reservation = mmap(0, 3 * ring, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)
+		enc.emit({0x31, 0xff});			// xor  edi, edi
+		enc.emit({0xbe});			// mov  esi, imm32
+		enc.emit32(3 * ring);
+		enc.emit({0x31, 0xd2});			// xor  edx, edx
+		enc.emit({0x41, 0xba});			// mov  r10d, imm32
+		enc.emit32(MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE);
+		enc.emit({0x49, 0xc7, 0xc0, 0xff, 0xff, 0xff, 0xff});	// mov  r8, -1
+		enc.emit({0x45, 0x31, 0xc9});		// xor  r9d, r9d
+		enc.emit({0xb8, 0x09, 0x00, 0x00, 0x00});	// mov  eax, 9 (mmap)
+		checked_syscall();
+		enc.emit({0x49, 0x89, 0xc4});		// mov  r12, rax
+
+		// fd = memfd_create("tape", 0), ftruncate(fd, ring)
+		enc.emit({0xb8, 0x3f, 0x01, 0x00, 0x00});	// mov  eax, 319 (memfd_create)
+		enc.emit({0x48, 0x8d, 0x3d});		// lea  rdi, [rip + name]
+		name_fixup = enc.here();
+		enc.emit32(0);
+		enc.emit({0x31, 0xf6});			// xor  esi, esi
+		checked_syscall();
+		enc.emit({0x49, 0x89, 0xc0});		// mov  r8, rax
+		enc.emit({0x89, 0xc7});			// mov  edi, eax
+		enc.emit({0xbe});			// mov  esi, imm32
+		enc.emit32(ring);
+		enc.emit({0xb8, 0x4d, 0x00, 0x00, 0x00});	// mov  eax, 77 (ftruncate)
+		checked_syscall();
+
+		// mmap(reservation + k * ring, ring, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) three times,
+		// the syscalls preserve the arguments
+		enc.emit({0x4c, 0x89, 0xe7});		// mov  rdi, r12
+		enc.emit({0xba});			// mov  edx, imm32
+		enc.emit32(PROT_READ | PROT_WRITE);
+		enc.emit({0x41, 0xba});			// mov  r10d, imm32
+		enc.emit32(MAP_SHARED | MAP_FIXED);
+
+		for (int k = 0; k < 3; ++k) {
+			enc.emit({0xb8, 0x09, 0x00, 0x00, 0x00});	// mov  eax, 9 (mmap)
+			checked_syscall();
+			enc.emit({0x48, 0x01, 0xf7});	// add  rdi, rsi
+		}
+
+		enc.emit({0x49, 0x81, 0xc4});		// add  r12, imm32
+		enc.emit32(ring);
+		enc.emit({0x31, 0xdb});			// xor  ebx, ebx
+	}
+	else {
+		enc.emit({0x48, 0xbb});			// mov  rbx, imm64
+		head_fixup = enc.here();
+		enc.emit32(0);
+		enc.emit32(0);
+	}
+
+	encode_x86(enc, program, ring);
+	enc.emit({0xb8, 0x3c, 0x00, 0x00, 0x00});	// mov  eax, 60 (exit)
+	enc.emit({0x31, 0xff});			// xor  edi, edi
+	enc.emit({0x0f, 0x05});			// syscall
+
+	// the byte to write is in edi, as for putchar
+	const size_t putchar_address = enc.here();
+	enc.emit({0x57});			// push rdi
+	enc.emit({0xb8, 0x01, 0x00, 0x00, 0x00});	// mov  eax, 1 (write)
+	enc.emit({0xbf, 0x01, 0x00, 0x00, 0x00});	// mov  edi, 1
+	enc.emit({0x48, 0x89, 0xe6});		// mov  rsi, rsp
+	enc.emit({0xba, 0x01, 0x00, 0x00, 0x00});	// mov  edx, 1
+	enc.emit({0x0f, 0x05});			// syscall
+	enc.emit({0x5f});			// pop  rdi
+	enc.emit({0xc3});			// ret
+
+	// returns the byte read, or -1 which is then mapped to 0 by the caller
+	const size_t getchar_address = enc.here();
+	enc.emit({0x6a, 0x00});			// push 0
+	enc.emit({0x31, 0xc0});			// xor  eax, eax (read)
+	enc.emit({0x31, 0xff});			// xor  edi, edi
+	enc.emit({0x48, 0x89, 0xe6});		// mov  rsi, rsp
+	enc.emit({0xba, 0x01, 0x00, 0x00, 0x00});	// mov  edx, 1
+	enc.emit({0x0f, 0x05});			// syscall
+	enc.emit({0x48, 0x85, 0xc0});		// test rax, rax
+	enc.emit({0x59});			// pop  rcx
+	enc.emit({0x7e, 0x03});			// jle  +3
+	enc.emit({0x89, 0xc8});			// mov  eax, ecx
+	enc.emit({0xc3});			// ret
+	enc.emit({0x83, 0xc8, 0xff});		// or   eax, -1
+	enc.emit({0xc3});			// ret
+
+	if (ring != 0) {
+		for (size_t at : failures) {
+			enc.patch32(at, enc.here() - (at + 4));
+		}
+
+		enc.emit({0xb8, 0x3c, 0x00, 0x00, 0x00});	// mov  eax, 60 (exit)
+		enc.emit({0xbf, 0x01, 0x00, 0x00, 0x00});	// mov  edi, 1
+		enc.emit({0x0f, 0x05});		// syscall
+
+		enc.patch32(name_fixup, enc.here() - (name_fixup + 4));
+		enc.emit({'t', 'a', 'p', 'e', '\0'});
+	}
+
+	for (const auto &call : enc.calls) {
+		const size_t target = strcmp(call.second, "putchar") == 0 ? putchar_address : getchar_address;
+		enc.patch32(call.first, target - (call.first + 4));
+	}
+
+	const uint64_t memory_address = (text_address + code_offset + enc.code.size() + 0xfff) & ~uint64_t(0xfff);
+
+	if (ring == 0) {
+		enc.patch64(head_fixup, memory_address + reach);
+	}
+
+	Elf64_Ehdr header{};
+	memcpy(header.e_ident, ELFMAG, SELFMAG);
+	header.e_ident[EI_CLASS]   = ELFCLASS64;
+	header.e_ident[EI_DATA]    = ELFDATA2LSB;
+	header.e_ident[EI_VERSION] = EV_CURRENT;
+	header.e_type      = ET_EXEC;
+	header.e_machine   = EM_X86_64;
+	header.e_version   = EV_CURRENT;
+	header.e_entry     = text_address + code_offset;
+	header.e_phoff     = sizeof(Elf64_Ehdr);
+	header.e_ehsize    = sizeof(Elf64_Ehdr);
+	header.e_phentsize = sizeof(Elf64_Phdr);
+	header.e_phnum     = segments;
+
+	Elf64_Phdr text{};
+	text.p_type   = PT_LOAD;
+	text.p_flags  = PF_R | PF_X;
+	text.p_vaddr  = text_address;
+	text.p_paddr  = text_address;
+	text.p_filesz = code_offset + enc.code.size();
+	text.p_memsz  = code_offset + enc.code.size();
+	text.p_align  = 0x1000;
+
+	Elf64_Phdr memory{};
+	memory.p_type  = PT_LOAD;
+	memory.p_flags = PF_R | PF_W;
+	memory.p_vaddr = memory_address;
+	memory.p_paddr = memory_address;
+	memory.p_memsz = 2 * reach;
+	memory.p_align = 0x1000;
+
+	std::vector<uint8_t> file;
+	append_bytes(file, header);
+	append_bytes(file, text);
+
+	if (ring == 0) {
+		append_bytes(file, memory);
+	}
+
+	file.insert(file.end(), enc.code.begin(), enc.code.end());
+
+	out.write(reinterpret_cast<const char *>(file.data()), file.size());
+}
+
+
+// The modes handled by generate, the third argument or any argument that isn't an option
+const std::vector<std::string> generator_modes = {
+	"--transpile", "--transpile_optimized", "--compile_to_x86", "--compile_to_arm", "--compile_to_aarch64",
+	"--emit-llvm", "--compile_to_elf", "--compile_to_exe", "--emit-ir"
+};
+
+
+bool is_generator_mode(const char *mode) {
+	return std::find(generator_modes.begin(), generator_modes.end(), mode) != generator_modes.end();
+}
+
+
+// Writes the artifact of a code generation mode, returns false for an unknown mode without writing anything.
+// Only the C backends support cells wider than 8 bits, all of them support the ring tape
+bool generate(std::ostream &out, const char *mode, const std::vector<Instruction> &program, const RunOptions &options = {}) {
+	TextEmitter text(out);
+
+	const int cell_bits = options.cell_bits;
+	const size_t ring   = options.tape == TapeKind::Ring ? options.ring : 0;
+
+	if (strcmp(mode, "--transpile") == 0) {
+		transpile_to_c(text, program, false, cell_bits, tape_reach, ring);
+	}
+	else if (strcmp(mode, "--transpile_optimized") == 0) {
+		transpile_to_c(text, program, true, cell_bits, tape_reach, ring);
+	}
+	else if (strcmp(mode, "--compile_to_x86") == 0) {
+		compile_to_x86_asm(text, program, ring);
+	}
+	else if (strcmp(mode, "--compile_to_arm") == 0) {
+		compile_to_arm_asm(text, program, ring);
+	}
+	else if (strcmp(mode, "--compile_to_aarch64") == 0) {
+		compile_to_aarch64_asm(text, program, ring);
+	}
+	else if (strcmp(mode, "--emit-llvm") == 0) {
+		emit_llvm_ir(text, program, ring);
+	}
+	else if (strcmp(mode, "--compile_to_elf") == 0) {
+		compile_to_elf_object(out, program, ring);
+	}
+	else if (strcmp(mode, "--compile_to_exe") == 0) {
+		compile_to_elf_executable(out, program, tape_reach, ring);
+	}
+	else if (strcmp(mode, "--emit-ir") == 0) {
+		write_ir(out, program);
+	}
+	else {
+		return false;
+	}
+
+	return true;
+}
+
+
+// Compile cache: the artifacts are stored in a directory under a hash of the source, the options and the build
+// of bf itself. The interpreter caches the optimized program as a .bfo file and then maps it.
+// Entries are written to a temporary file and renamed, so concurrent invocations never see a partial one;
+// hits refresh the modification time, that is used to evict the least recently used entries
+// when the directory grows past cache_limit
+const size_t cache_limit = 256 << 20;
+const char  *build_stamp = __DATE__ " " __TIME__;
+
+
+uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 0xcbf29ce484222325) {
+	const unsigned char *bytes = static_cast<const unsigned char *>(data);
+
+	for (size_t i = 0; i < size; ++i) {
+		hash = (hash ^ bytes[i]) * 0x100000001b3;
+	}
+
+	return hash;
+}
+
+
+// Empty string when the source can't be read, then the cache is not used
+std::string cache_entry(const char *directory, const char *path, const char *mode, const std::vector<std::string> &pipeline, const RunOptions &tape) {
+	const int fd = open(path, O_RDONLY);
+	struct stat info;
+
+	if (fd < 0 or fstat(fd, &info) != 0 or not S_ISREG(info.st_mode)) {
+		if (fd >= 0) close(fd);
+		return "";
+	}
+
+	std::string options = std::string(build_stamp) + '\0' + (mode == nullptr ? "--run" : mode) + '\0' + std::to_string(tape.cell_bits);
+
+	// the ring changes the generated code, the interpreter gets it at run time
+	if (mode != nullptr and tape.tape == TapeKind::Ring) {
+		options += '\0' + ("ring=" + std::to_string(tape.ring));
+	}
+
+	for (const std::string &name : pipeline) {
+		options += '\0' + name;
+	}
+
+	uint64_t hash = fnv1a(options.data(), options.size());
+
+	if (info.st_size > 0) {
+		void *source = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (source == MAP_FAILED) {
+			close(fd);
+			return "";
+		}
+
+		hash = fnv1a(source, info.st_size, hash);
+		munmap(source, info.st_size);
+	}
+
+	close(fd);
+
+	char name[17];
+	snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+	return std::string(directory) + '/' + name;
+}
+
+
+void make_directories(const std::string &path) {
+	for (size_t i = 1; i <= path.size(); ++i) {
+		if (i == path.size() or path[i] == '/') {
+			mkdir(path.substr(0, i).c_str(), 0755);
+		}
+	}
+}
+
+
+// Removes the least recently used entries until the directory fits in cache_limit, `keep` excluded
+void evict_cache(const char *directory, const std::string &keep) {
+	struct Entry {
+		time_t modified;
+		off_t size;
+		std::string path;
+	};
+
+	DIR *dir = opendir(directory);
+	if (dir == nullptr) {
+		return;
+	}
+
+	std::vector<Entry> entries;
+	size_t total = 0;
+
+	while (const dirent *file = readdir(dir)) {
+		struct stat info;
+		const std::string path = std::string(directory) + '/' + file->d_name;
+
+		// skips ".", ".." and the temporary files of the other invocations
+		if (file->d_name[0] == '.' or stat(path.c_str(), &info) != 0 or not S_ISREG(info.st_mode)) {
+			continue;
+		}
+
+		total += info.st_size;
+		if (path != keep) {
+			entries.push_back({info.st_mtime, info.st_size, path});
+		}
+	}
+
+	closedir(dir);
+
+	std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.modified < b.modified; });
+
+	for (size_t i = 0; i < entries.size() and total > cache_limit; ++i) {
+		if (unlink(entries[i].path.c_str()) == 0) {
+			total -= entries[i].size;
+		}
+	}
+}
+
+
+// Runs or prints a cached artifact, returns false on a miss. `stats` is the format of the tape usage printed
+// after a run, nullptr for none
+bool serve_cached(const std::string &entry, const char *mode, const RunOptions &options, const char *stats) {
+	if (mode == nullptr) {
+		size_t size = 0;
+		const Instruction *program = map_ir_file(entry.c_str(), size);
+
+		if (program == nullptr) {
+			return false;
+		}
+
+		utimensat(AT_FDCWD, entry.c_str(), nullptr, 0);
+
+		if (options.bench) {
+			benchmark(program, size, options);
+		}
+		else {
+			const TapeUsage usage = run_stdin(program, size, options);
+
+			if (stats != nullptr) {
+				print_tape_usage(std::cerr, usage, strcmp(stats, "json") == 0);
+			}
+		}
+
+		return true;
+	}
+
+	std::ifstream artifact(entry, std::ios::binary);
+	if (not artifact) {
+		return false;
+	}
+
+	utimensat(AT_FDCWD, entry.c_str(), nullptr, 0);
+	std::cout << artifact.rdbuf();
+	return true;
+}
+
+
+// $XDG_CACHE_HOME/bf, ~/.cache/bf otherwise
+const char *default_cache_directory() {
+	static std::string directory;
+
+	if (const char *xdg = getenv("XDG_CACHE_HOME"); xdg != nullptr and xdg[0] != '\0') {
+		directory = std::string(xdg) + "/bf";
+	}
+	else {
+		const char *home = getenv("HOME");
+		directory = std::string(home != nullptr ? home : ".") + "/.cache/bf";
+	}
+
+	return directory.c_str();
+}
+
+
+// Stores the artifact of `mode` for `program` under `entry`, atomically
+bool store_cached(const char *directory, const std::string &entry, const char *mode, const std::vector<Instruction> &program, const RunOptions &options) {
+	make_directories(directory);
+
+	const std::string temporary = std::string(directory) + "/.tmp." + std::to_string(getpid());
+
+	{
+		std::ofstream out(temporary, std::ios::binary);
+
+		bool written = true;
+
+		if (mode == nullptr) {
+			write_ir(out, program);
+		}
+		else {
+			written = generate(out, mode, program, options);
+		}
+
+		if (not written or not out.flush()) {
+			unlink(temporary.c_str());
+			return false;
+		}
+	}
+
+	if (rename(temporary.c_str(), entry.c_str()) != 0) {
+		unlink(temporary.c_str());
+		return false;
+	}
+
+	evict_cache(directory, entry);
+	return true;
+}
+
+
+// Incremental optimization: every region (see split_regions) is fingerprinted by its instructions, their positions
+// in it, the pipeline and whether it starts the program. The optimized regions of the last compilation of the same file are
+// kept in a single file of the cache, so after an edit only the regions that changed go through the passes.
+// Jump targets are not stored, build_jump_table fills them for the whole program afterwards
+struct RegionHeader {
+	uint64_t fingerprint;
+	uint64_t count;
+};
+
+
+const char     region_magic[4] = {'B', 'F', 'R', '\0'};
+const uint32_t region_version  = 1;
+
+
+uint64_t region_fingerprint(const std::vector<Instruction> &program, size_t begin, size_t end, const std::vector<std::string> &pipeline) {
+	uint64_t hash = fnv1a(build_stamp, strlen(build_stamp));
+
+	for (const std::string &name : pipeline) {
+		hash = fnv1a(name.data(), name.size() + 1, hash);
+	}
+
+	const bool program_start = begin == 0;
+	hash = fnv1a(&program_start, sizeof(program_start), hash);
+
+	for (size_t i = begin; i < end; ++i) {
+		// the operand of a bracket is its absolute jump target
+		const int operand = program[i].opcode == '[' or program[i].opcode == ']' ? 0 : program[i].operand;
+		// the stored positions are relative to the region, so comments that move them must not match
+		const int position = program[i].position - program[begin].position;
+
+		hash = fnv1a(&program[i].opcode, sizeof(program[i].opcode), hash);
+		hash = fnv1a(&operand, sizeof(operand), hash);
+		hash = fnv1a(&position, sizeof(position), hash);
+	}
+
+	return hash;
+}
+
+
+// Regions of the previous compilation, indexed by fingerprint, with positions relative to the region
+using RegionTable = std::map<uint64_t, std::vector<Instruction>>;
+
+
+RegionTable load_regions(const std::string &path) {
+	RegionTable regions;
+	std::ifstream in(path, std::ios::binary | std::ios::ate);
+	IrHeader header;
+
+	// a damaged count must not allocate more instructions than the file could hold
+	uint64_t remaining = in ? uint64_t(in.tellg()) : 0;
+	in.seekg(0);
+
+	if (not in.read(reinterpret_cast<char *>(&header), sizeof(header))
+		or memcmp(header.magic, region_magic, sizeof(region_magic)) != 0
+		or header.version != region_version or header.instruction_size != sizeof(Instruction)) {
+		return regions;
+	}
+
+	remaining -= sizeof(header);
+
+	for (uint64_t i = 0; i < header.count; ++i) {
+		RegionHeader region;
+
+		if (not in.read(reinterpret_cast<char *>(&region), sizeof(region))) {
+			return {};
+		}
+
+		remaining -= sizeof(region);
+
+		if (region.count > remaining / sizeof(Instruction)) {
+			return {};
+		}
+
+		remaining -= region.count * sizeof(Instruction);
+
+		std::vector<Instruction> &instructions = regions[region.fingerprint];
+		instructions.resize(region.count);
+
+		if (not in.read(reinterpret_cast<char *>(instructions.data()), region.count * sizeof(Instruction))) {
+			return {};
+		}
+	}
+
+	return regions;
+}
+
+
+bool store_regions(const char *directory, const std::string &path, const RegionTable &regions) {
+	make_directories(directory);
+
+	const std::string temporary = std::string(directory) + "/.tmp." + std::to_string(getpid());
+
+	{
+		std::ofstream out(temporary, std::ios::binary);
+		IrHeader header = {};
+
+		memcpy(header.magic, region_magic, sizeof(region_magic));
+		header.version          = region_version;
+		header.instruction_size = sizeof(Instruction);
+		header.count            = regions.size();
+		out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+		for (const auto &[fingerprint, instructions] : regions) {
+			const RegionHeader region = {fingerprint, instructions.size()};
+
+			out.write(reinterpret_cast<const char *>(&region), sizeof(region));
+			out.write(reinterpret_cast<const char *>(instructions.data()), instructions.size() * sizeof(Instruction));
+		}
+
+		if (not out.flush()) {
+			unlink(temporary.c_str());
+			return false;
+		}
+	}
+
+	if (rename(temporary.c_str(), path.c_str()) != 0) {
+		unlink(temporary.c_str());
+		return false;
+	}
+
+	evict_cache(directory, path);
+	return true;
+}
+
+
+// Same result as optimize. `program` must have its jump table
+std::vector<Instruction> optimize_incremental(const std::vector<Instruction> &program, const std::vector<std::string> &pipeline, const char *directory, const char *source_path, Statistics *statistics = nullptr) {
+	const auto start = std::chrono::steady_clock::now();
+
+	char *absolute = realpath(source_path, nullptr);
+	const std::string key = absolute != nullptr ? absolute : source_path;
+	free(absolute);
+
+	char name[32];
+	snprintf(name, sizeof(name), "regions-%016llx", static_cast<unsigned long long>(fnv1a(key.data(), key.size())));
+	const std::string path = std::string(directory) + '/' + name;
+
+	const std::vector<std::pair<size_t, size_t>> regions = split_regions(program);
+	const RegionTable previous = load_regions(path);
+	RegionTable current;
+
+	// the first region with every new fingerprint is optimized, in parallel
+	std::vector<uint64_t> fingerprints(regions.size());
+	std::vector<size_t> missing;
+
+	for (size_t i = 0; i < regions.size(); ++i) {
+		fingerprints[i] = region_fingerprint(program, regions[i].first, regions[i].second, pipeline);
+
+		if (current.count(fingerprints[i]) != 0) {
+			continue;
+		}
+
+		auto cached = previous.find(fingerprints[i]);
+
+		if (cached != previous.end()) {
+			current.emplace(fingerprints[i], cached->second);
+		}
+		else {
+			current.emplace(fingerprints[i], std::vector<Instruction>());
+			missing.push_back(i);
+		}
+	}
+
+	std::vector<std::vector<Instruction>> optimized(missing.size());
+
+	parallel_for(missing.size(), optimizer_threads(program), [&](size_t k) {
+		const auto [begin, end] = regions[missing[k]];
+		optimized[k] = optimize_region(program, begin, end, pipeline);
+
+		for (Instruction &I : optimized[k]) {
+			I.position -= program[begin].position;
+		}
+	});
+
+	for (size_t k = 0; k < missing.size(); ++k) {
+		current[fingerprints[missing[k]]] = std::move(optimized[k]);
+	}
+
+	std::vector<Instruction> result;
+	result.reserve(program.size());
+
+	for (size_t i = 0; i < regions.size(); ++i) {
+		const int base = program[regions[i].first].position;
+
+		for (Instruction I : current[fingerprints[i]]) {
+			I.position += base;
+			result.push_back(I);
+		}
+	}
+
+	store_regions(directory, path, current);
+
+	if (statistics) {
+		const size_t reused = regions.size() - missing.size();
+
+		statistics->push_back({"reused " + std::to_string(reused) + "/" + std::to_string(regions.size()), milliseconds_since(start),
+			program.size(), result.size(), count_loops(program), count_loops(result), peak_memory_kb()});
+	}
+
+	return result;
+}
+
+
+std::vector<std::string> split(const char *text, char separator) {
+	std::vector<std::string> result(1);
+
+	for (; *text != '\0'; ++text) {
+		if (*text == separator) {
+			result.emplace_back();
+		}
+		else {
+			result.back() += *text;
+		}
+	}
+
+	return result;
+}
+
+
+int main(int argc, char *argv[]) {
+	if (argc < 3) {
+		std::cerr << "Usage        bf program.b \"input stream\" [mode] [options]" << std::endl;
+		std::cerr << "Alternative  bf program.b - [mode] [options]" << std::endl;
+		std::cerr << "             program.b can also be a .bfo file written by --emit-ir" << std::endl;
+		std::cerr << "Options      -O0 -O1 -O2 -O3 --passes=fold,clear,linear,offset,zero --stats --stats=json" << std::endl;
+		std::cerr << "             --stream (with --transpile or --compile_to_x86, program.b can be - for stdin)" << std::endl;
+		std::cerr << "             --cache --cache=directory (default $XDG_CACHE_HOME/bf or ~/.cache/bf)" << std::endl;
+		std::cerr << "             --incremental (reoptimizes only the top-level loops that changed since the last run)" << std::endl;
+		std::cerr << "             --tape=dense --tape=sparse (interpreter only)" << std::endl;
+		std::cerr << "             --tape=ring --tape=ring:cells (power of two, default 65536, wraps around)" << std::endl;
+		std::cerr << "             --cell-bits=8|16|32|64 (interpreter, --transpile and --transpile_optimized)" << std::endl;
+		std::cerr << "             --batch (interpreter, runs the program once for every line of the input)" << std::endl;
+		std::cerr << "             --snapshot (with --batch, the runs resume from a snapshot taken before the first input)" << std::endl;
+		std::cerr << "             --huge-pages=off|transparent|explicit (interpreter, dense tape and large programs)" << std::endl;
+		std::cerr << "             --bench (interpreter, compares the huge page policies with the perf counters)" << std::endl;
+		std::cerr << "             --profile=dump (interpreter, records the accesses to the tape, prints a summary)" << std::endl;
+		std::cerr << "             --value-ranges (interpreter, which cells could be packed, by analysis and by execution)" << std::endl;
+		return 1;
+	}
+
+
+	const char *mode  = nullptr;
+	const char *stats = nullptr;
+	bool stream = false;
+	bool incremental = false;
+	RunOptions options;
+	const char *profile_path = nullptr;
+	bool value_ranges = false;
+	const char *cache_directory = nullptr;
+	std::vector<std::string> pipeline = optimization_pipeline(2);
+
+	for (int i = 3; i < argc; ++i) {
+		if (strncmp(argv[i], "-O", 2) == 0) {
+			if (argv[i][2] < '0' or argv[i][2] > '3' or argv[i][3] != '\0') {
+				std::cerr << "The optimization level must be -O0, -O1, -O2 or -O3" << std::endl;
+				return 1;
+			}
+
+			pipeline = optimization_pipeline(argv[i][2] - '0');
+		}
+		else if (strcmp(argv[i], "--stats") == 0 or strncmp(argv[i], "--stats=", 8) == 0) {
+			stats = argv[i][7] == '=' ? argv[i] + 8 : "text";
+		}
+		else if (strcmp(argv[i], "--cache") == 0 or strncmp(argv[i], "--cache=", 8) == 0) {
+			cache_directory = argv[i][7] == '=' ? argv[i] + 8 : default_cache_directory();
+		}
+		else if (strcmp(argv[i], "--tape=dense") == 0 or strcmp(argv[i], "--tape=sparse") == 0) {
+			options.tape = argv[i][7] == 's' ? TapeKind::Sparse : TapeKind::Dense;
+			options.ring = 0;
+		}
+		else if (strcmp(argv[i], "--tape=ring") == 0 or strncmp(argv[i], "--tape=ring:", 12) == 0) {
+			options.tape = TapeKind::Ring;
+			options.ring = argv[i][11] == ':' ? strtoull(argv[i] + 12, nullptr, 10) : 1 << 16;
+
+			if (options.ring < 2 or options.ring > (size_t(1) << 30) or (options.ring & (options.ring - 1)) != 0) {
+				std::cerr << "The ring tape must have a power of two cells, up to 2^30" << std::endl;
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--cell-bits=", 12) == 0) {
+			options.cell_bits = atoi(argv[i] + 12);
+
+			if (options.cell_bits != 8 and options.cell_bits != 16 and options.cell_bits != 32 and options.cell_bits != 64) {
+				std::cerr << "Cells can only be 8, 16, 32 or 64 bits wide" << std::endl;
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--batch") == 0) {
+			options.batch = true;
+		}
+		else if (strcmp(argv[i], "--snapshot") == 0) {
+			options.snapshot = true;
+		}
+		else if (strncmp(argv[i], "--huge-pages=", 13) == 0) {
+			const char *policy = argv[i] + 13;
+
+			if (strcmp(policy, "off") == 0) {
+				options.huge_pages = HugePages::Off;
+			}
+			else if (strcmp(policy, "transparent") == 0) {
+				options.huge_pages = HugePages::Transparent;
+			}
+			else if (strcmp(policy, "explicit") == 0) {
+				options.huge_pages = HugePages::Explicit;
+			}
+			else {
+				std::cerr << "Huge pages can only be off, transparent or explicit" << std::endl;
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--bench") == 0) {
+			options.bench = true;
+		}
+		else if (strncmp(argv[i], "--profile=", 10) == 0) {
+			profile_path = argv[i] + 10;
+		}
+		else if (strcmp(argv[i], "--value-ranges") == 0) {
+			value_ranges = true;
+		}
+		else if (strcmp(argv[i], "--incremental") == 0) {
+			incremental = true;
+		}
+		else if (strcmp(argv[i], "--stream") == 0) {
+			stream = true;
+		}
+		else if (strncmp(argv[i], "--passes=", 9) == 0) {
+			pipeline = split(argv[i] + 9, ',');
+
+			for (const std::string &name : pipeline) {
+				find_pass(name);
+			}
+		}
+		else if (strncmp(argv[i], "--", 2) == 0 and not is_generator_mode(argv[i])) {
+			std::cerr << "Unknown option " << argv[i] << std::endl;
+			return 1;
+		}
+		else {
+			mode = argv[i];
+		}
+	}
+
+
+	if (mode != nullptr and not is_generator_mode(mode)) {
+		std::cerr << "Unknown mode " << mode << std::endl;
+		return 1;
+	}
+
+
+	if (options.cell_bits != 8 and mode != nullptr and strcmp(mode, "--transpile") != 0 and strcmp(mode, "--transpile_optimized") != 0) {
+		std::cerr << "--cell-bits is only supported by the interpreter, --transpile and --transpile_optimized" << std::endl;
+		return 1;
+	}
+
+
+	if ((options.huge_pages != HugePages::Off or options.bench) and (mode != nullptr or options.tape != TapeKind::Dense)) {
+		std::cerr << "--huge-pages and --bench are only supported by the interpreter, with the dense tape" << std::endl;
+		return 1;
+	}
+
+
+	if (options.snapshot and (mode != nullptr or not options.batch or options.tape != TapeKind::Dense or options.huge_pages != HugePages::Off
+		or options.bench or profile_path != nullptr or value_ranges)) {
+		std::cerr << "--snapshot is only supported by the interpreter with --batch and the dense tape, "
+			<< "without --huge-pages, --bench, --profile and --value-ranges" << std::endl;
+		return 1;
+	}
+
+
+	std::unique_ptr<TapeProfile> profile;
+
+	if (profile_path != nullptr) {
+		if (mode != nullptr or options.bench) {
+			std::cerr << "--profile is only supported by the interpreter, without --bench" << std::endl;
+			return 1;
+		}
+
+		profile = std::make_unique<TapeProfile>(profile_path);
+
+		if (not profile->good()) {
+			std::cerr << "Cannot write the profile to " << profile_path << std::endl;
+			return 1;
+		}
+
+		options.profile = profile.get();
+	}
+
+	std::unique_ptr<ValueProfile> values;
+
+	if (value_ranges) {
+		if (mode != nullptr or options.bench or profile != nullptr or options.tape == TapeKind::Ring) {
+			std::cerr << "--value-ranges is only supported by the interpreter, without --bench, --profile and the ring tape" << std::endl;
+			return 1;
+		}
+
+		values = std::make_unique<ValueProfile>();
+		options.values = values.get();
+	}
+
+
+	// runtime.c and the executables map the copies of the ring by pages, the transpiled C allocates a single one
+	const bool compiled = mode != nullptr and strcmp(mode, "--emit-ir") != 0;
+	const bool mirrored = compiled and strncmp(mode, "--transpile", 11) != 0;
+
+	if (options.tape == TapeKind::Ring and mirrored and options.ring % 4096 != 0) {
+		std::cerr << "The assembly, LLVM and machine code backends need a ring tape of at least 4096 cells" << std::endl;
+		return 1;
+	}
+
+
+	// the streaming mode skips the optimizer, which needs the whole program
+	if (stream) {
+		TextEmitter text(std::cout);
+
+		std::ifstream file;
+		std::istream &in = strcmp(argv[1], "-") == 0 ? std::cin : (file.open(argv[1]), file);
+
+		if (not in) {
+			std::cerr << "Cannot open " << argv[1] << std::endl;
+			return 1;
+		}
+
+		if (mode != nullptr and strcmp(mode, "--transpile") == 0) {
+			transpile_to_plain_c(text, StreamingProgram(in), options.cell_bits, tape_reach, options.ring);
+		}
+		else if (mode != nullptr and strcmp(mode, "--compile_to_x86") == 0) {
+			compile_to_x86_asm(text, StreamingProgram(in), options.ring);
+		}
+		else {
+			std::cerr << "--stream is only supported by --transpile and --compile_to_x86" << std::endl;
+			return 1;
+		}
+
+		return 0;
+	}
+
+
+	std::string cache_path;
+
+	if (cache_directory != nullptr) {
+		cache_path = cache_entry(cache_directory, argv[1], mode, pipeline, options);
+
+		if (not cache_path.empty() and serve_cached(cache_path, mode, options, stats)) {
+			return 0;
+		}
+	}
+
+	// the optimized regions are kept in the cache directory, whole programs are cached only with --cache
+	if (incremental and cache_directory == nullptr) {
+		cache_directory = default_cache_directory();
+	}
+
+
+	// an optimized .bfo file skips the loader, the jump table and the optimizer
+	size_t mapped_size = 0;
+	const Instruction *mapped = map_ir_file(argv[1], mapped_size);
+
+	if (mapped != nullptr and mode == nullptr) {
+		if (options.bench) {
+			benchmark(mapped, mapped_size, options);
+			return 0;
+		}
+
+		const TapeUsage usage = run_stdin(mapped, mapped_size, options);
+
+		if (stats != nullptr) {
+			print_tape_usage(std::cerr, usage, strcmp(stats, "json") == 0);
+		}
+
+		return 0;
+	}
+
+
+	Statistics statistics;
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<Instruction> program = mapped != nullptr ? std::vector<Instruction>(mapped, mapped + mapped_size) : load_program_file(argv[1]);
+	statistics.push_back({"load_program_file", milliseconds_since(start), 0, program.size(), count_loops(program), count_loops(program), peak_memory_kb()});
+
+	start = std::chrono::steady_clock::now();
+	if (not build_jump_table(program)) {
+		return 1;
+	}
+	statistics.push_back({"build_jump_table", milliseconds_since(start), program.size(), program.size(), count_loops(program), count_loops(program), peak_memory_kb()});
+
+	if (mapped == nullptr) {
+		program = incremental ? optimize_incremental(program, pipeline, cache_directory, argv[1], &statistics) : optimize(program, pipeline, &statistics);
+		if (not build_jump_table(program)) {
+			return 1;
+		}
+	}
+
+	if (stats != nullptr) {
+		print_statistics(std::cerr, statistics, strcmp(stats, "json") == 0);
+	}
+
+	if (options.tape == TapeKind::Ring and compiled) {
+		wrap_offsets(program, options.ring);
+	}
+
+
+	if (not cache_path.empty() and store_cached(cache_directory, cache_path, mode, program, options) and serve_cached(cache_path, mode, options, stats)) {
+		return 0;
+	}
+
+	if (mode != nullptr) {
+		if (not generate(std::cout, mode, program, options)) {
+			std::cerr << "Unknown mode " << mode << std::endl;
+			return 1;
+		}
+	}
+
+	else if (options.bench) {
+		benchmark(program.data(), program.size(), options);
+	}
+
+	else {
+		const TapeUsage usage = run_stdin(program.data(), program.size(), options);
+
+		if (stats != nullptr) {
+			print_tape_usage(std::cerr, usage, strcmp(stats, "json") == 0);
+		}
 	}
 
 
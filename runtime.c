@@ -1,15 +1,111 @@
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
 void run(char *memory);
 
 
-#ifndef MEMORY_SIZE
-#define MEMORY_SIZE 1000
+// cells reserved on both sides of the starting one, the pages are committed on first touch,
+// as transparent huge pages with -DTAPE_HUGE_PAGES when the kernel has them
+#ifndef TAPE_REACH
+#define TAPE_REACH ((size_t) 1 << 28)
+#endif
+
+
+// the tape sits between two inaccessible guards larger than any move plus offset,
+// so running off its ends faults instead of corrupting memory
+#if UINTPTR_MAX > 0xffffffff
+#define TAPE_GUARD ((size_t) 1 << 32)
+#else
+#define TAPE_GUARD ((size_t) 1 << 24)
+#endif
+
+
+#ifndef TAPE_RING
+
+static char *tape_begin;
+static char *tape_end;
+
+
+static void tape_fault(int number, siginfo_t *info, void *context) {
+	const char *address = info->si_addr;
+	static const char message[] = "Tape overflow\n";
+
+	(void) context;
+	if ((address >= tape_begin - TAPE_GUARD && address < tape_begin) || (address >= tape_end && address < tape_end + TAPE_GUARD)) {
+		if (write(2, message, sizeof(message) - 1) < 0) _exit(1);
+		_exit(1);
+	}
+
+	signal(number, SIG_DFL);
+}
+
+
+static char *allocate_tape(size_t reach) {
+	const size_t page = sysconf(_SC_PAGESIZE);
+	struct sigaction action = {0};
+	char *base;
+
+	reach = (reach + page - 1) / page * page;
+	base = mmap(NULL, 2 * reach + 2 * TAPE_GUARD, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if (base == MAP_FAILED || mprotect(base + TAPE_GUARD, 2 * reach, PROT_READ | PROT_WRITE) != 0) {
+		static const char message[] = "Cannot allocate the tape\n";
+		if (write(2, message, sizeof(message) - 1) < 0) _exit(1);
+		_exit(1);
+	}
+
+	tape_begin = base + TAPE_GUARD;
+	tape_end   = tape_begin + 2 * reach;
+
+#ifdef TAPE_HUGE_PAGES
+	madvise(tape_begin, 2 * reach, MADV_HUGEPAGE);
 #endif
 
+	action.sa_sigaction = tape_fault;
+	action.sa_flags     = SA_SIGINFO;
+	sigaction(SIGSEGV, &action, NULL);
+
+	return tape_begin + reach;
+}
+
+#else
 
-char memory[MEMORY_SIZE];
+// with -DTAPE_RING=cells, for the programs compiled with the same --tape=ring:cells: the ring is mapped three
+// times in a row, the code only wraps the head around the middle copy when it moves
+static char *allocate_ring(size_t size) {
+	const size_t page = sysconf(_SC_PAGESIZE);
+	const int fd = memfd_create("tape", 0);
+	char *base = mmap(NULL, 3 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	int mapped = size % page == 0 && fd >= 0 && base != MAP_FAILED && ftruncate(fd, size) == 0;
+	int k;
+
+	for (k = 0; mapped && k < 3; ++k) {
+		mapped = mmap(base + k * size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED;
+	}
+
+	if (!mapped) {
+		static const char message[] = "Cannot allocate the ring tape\n";
+		if (write(2, message, sizeof(message) - 1) < 0) _exit(1);
+		_exit(1);
+	}
+
+	close(fd);
+	return base + size;
+}
+
+#endif
 
 
 int main() {
-	run(memory);
+#ifdef TAPE_RING
+	run(allocate_ring(TAPE_RING));
+#else
+	run(allocate_tape(TAPE_REACH));
+#endif
 	return 0;
 }